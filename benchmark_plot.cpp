@@ -0,0 +1,270 @@
+/*
+ * SPDX-FileCopyrightText: 2016 Dominik Wójt <domin144@o2.pl>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "benchmark_results.h"
+#include "plplot_playground_decimation.h"
+
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <plplot/plstream.h>
+
+/* A parameter of the benchmarks, which may be the x axis or tell the curves
+ * apart. */
+enum class Parameter
+{
+    size,
+    working_set,
+    threads,
+    commit
+};
+
+Parameter parse_parameter(const std::string &name)
+{
+    if(name == "size")
+        return Parameter::size;
+    if(name == "working_set")
+        return Parameter::working_set;
+    if(name == "threads")
+        return Parameter::threads;
+    if(name == "commit")
+        return Parameter::commit;
+    throw std::runtime_error("unknown parameter " + name);
+}
+
+/* Repeated runs of the same point are averaged. */
+struct Curve
+{
+    std::map<double, std::pair<double, int>> points;
+
+    void add(const double x, const double y)
+    {
+        std::pair<double, int> &point = points[x];
+        point.first += y;
+        ++point.second;
+    }
+};
+
+int main(int argc, const char *argv[]) try
+{
+    namespace po = boost::program_options;
+
+    plstream my_plot;
+    /* PLplot takes its own options, like -dev and -o, out of argv */
+    my_plot.parseopts(&argc, argv, PL_PARSE_SKIP);
+
+    po::options_description description(
+            "Plots results of cache_benchmark, appended to CSV files, to "
+            "compare commits.\n"
+            "Every variant of the benchmark gets a curve for every value of "
+            "the parameters other than x, which can be narrowed by the "
+            "filters. The commits are ordered as they first appear in the "
+            "files. Options of PLplot are accepted too.\n"
+            "Options");
+    description.add_options()
+        ("help,h", "print help")
+        ("benchmark",
+            po::value<std::string>()->default_value("cache"),
+            "benchmark of cache_benchmark to plot: cache, "
+            "cache_tail_latency or heap_sort")
+        ("x",
+            po::value<std::string>()->default_value("size"),
+            "x axis: size, working_set, threads or commit")
+        ("y",
+            po::value<std::string>()->default_value("ns_per_op"),
+            "y axis: ns_per_op or hit_rate")
+        ("variant", po::value<std::vector<std::string>>(), "plot only these")
+        ("commit", po::value<std::vector<std::string>>(), "plot only these")
+        ("size", po::value<std::vector<std::int64_t>>(), "plot only these")
+        ("working-set",
+            po::value<std::vector<std::int64_t>>(),
+            "plot only these")
+        ("threads", po::value<std::vector<int>>(), "plot only these")
+        ("input", po::value<std::vector<std::string>>(), "CSV files");
+    po::positional_options_description positional;
+    positional.add("input", -1);
+    po::variables_map vm;
+    po::store(
+            po::command_line_parser(argc, argv)
+                .options(description)
+                .positional(positional)
+                .run(),
+            vm);
+    po::notify(vm);
+
+    if(vm.count("help") || !vm.count("input"))
+    {
+        std::cout << description << '\n';
+        return vm.count("help") ? 0 : -1;
+    }
+
+    const std::string benchmark = vm["benchmark"].as<std::string>();
+    const Parameter x_parameter = parse_parameter(vm["x"].as<std::string>());
+    const std::string y_name = vm["y"].as<std::string>();
+    if(y_name != "ns_per_op" && y_name != "hit_rate")
+        throw std::runtime_error("unknown y axis " + y_name);
+    const bool hit_rate = y_name == "hit_rate";
+
+    const auto filter = [&](const char *const name, const auto &value)
+    {
+        using Value = std::decay_t<decltype(value)>;
+        if(!vm.count(name))
+            return true;
+        const std::vector<Value> &allowed =
+                vm[name].as<std::vector<Value>>();
+        return std::find(allowed.begin(), allowed.end(), value)
+                != allowed.end();
+    };
+
+    std::vector<std::string> commits;
+    std::map<std::string, Curve> curves;
+    for(const std::string &input : vm["input"].as<std::vector<std::string>>())
+    {
+        for(const Benchmark_result &result : read_results(input))
+        {
+            if(
+                    result.benchmark != benchmark
+                    || !filter("variant", result.variant)
+                    || !filter("commit", result.commit)
+                    || !filter("size", result.size)
+                    || !filter("working-set", result.working_set)
+                    || !filter("threads", result.threads))
+            {
+                continue;
+            }
+            const double y = hit_rate ? result.hit_rate : result.ns_per_op;
+            if(std::isnan(y))
+                continue;
+
+            auto commit = std::find(
+                    commits.begin(),
+                    commits.end(),
+                    result.commit);
+            if(commit == commits.end())
+                commit = commits.insert(commit, result.commit);
+
+            std::string label = result.variant;
+            double x = 0;
+            if(x_parameter == Parameter::size)
+            {
+                /* the working set grows with the size, so the curves keep
+                 * the ratio of the two */
+                x = result.size;
+                std::ostringstream ratio;
+                ratio << static_cast<double>(result.working_set) / result.size;
+                label += " ws/size " + ratio.str();
+            }
+            else
+            {
+                label += " size " + std::to_string(result.size);
+            }
+            if(x_parameter == Parameter::working_set)
+                x = result.working_set;
+            else if(x_parameter != Parameter::size)
+                label += " ws " + std::to_string(result.working_set);
+            if(x_parameter == Parameter::threads)
+                x = result.threads;
+            else
+                label += " t " + std::to_string(result.threads);
+            if(x_parameter == Parameter::commit)
+                x = commit - commits.begin();
+            else
+                label += " " + result.commit;
+            curves[label].add(x, y);
+        }
+    }
+    if(curves.empty())
+        throw std::runtime_error("no results to plot");
+
+    /* The sizes and the times span orders of magnitude, so they are plotted
+     * on logarithmic axes. */
+    const bool log_x = x_parameter != Parameter::commit;
+    const bool log_y = !hit_rate;
+    const auto scale = [](const bool log, const double value)
+    {
+        return log ? std::log10(value) : value;
+    };
+
+    Range x_range;
+    Range y_range;
+    for(const auto &curve : curves)
+    {
+        for(const auto &point : curve.second.points)
+        {
+            x_range.add(scale(log_x, point.first));
+            y_range.add(
+                    scale(log_y, point.second.first / point.second.second));
+        }
+    }
+    if(x_range.min == x_range.max)
+    {
+        x_range.min -= 0.5;
+        x_range.max += 0.5;
+    }
+    if(y_range.min == y_range.max)
+    {
+        y_range.min -= 0.5;
+        y_range.max += 0.5;
+    }
+    /* room for the labels at the ends of the curves */
+    x_range.max += (x_range.max - x_range.min) * 0.25;
+
+    my_plot.init();
+    my_plot.env(
+            x_range.min,
+            x_range.max,
+            y_range.min,
+            y_range.max,
+            0,
+            (log_x ? 10 : 0) + (log_y ? 20 : 0));
+    my_plot.lab(
+            vm["x"].as<std::string>().c_str(),
+            y_name.c_str(),
+            benchmark.c_str());
+    if(x_parameter == Parameter::commit)
+    {
+        for(std::size_t i = 0; i < commits.size(); ++i)
+        {
+            const double position =
+                    (i - x_range.min) / (x_range.max - x_range.min);
+            my_plot.mtex("b", 5, position, 0.5, commits[i].c_str());
+        }
+    }
+
+    int color = 0;
+    for(const auto &curve : curves)
+    {
+        std::vector<double> x;
+        std::vector<double> y;
+        for(const auto &point : curve.second.points)
+        {
+            x.push_back(scale(log_x, point.first));
+            y.push_back(
+                    scale(log_y, point.second.first / point.second.second));
+        }
+        /* color 0 is the background, 1 the axes */
+        my_plot.col0(2 + color++ % 14);
+        my_plot.line(static_cast<PLINT>(x.size()), x.data(), y.data());
+        /* a single point doesn't make a line */
+        my_plot.poin(static_cast<PLINT>(x.size()), x.data(), y.data(), 2);
+        my_plot.ptex(x.back(), y.back(), 1, 0, 0, (" " + curve.first).c_str());
+    }
+
+    return 0;
+}
+catch(std::exception &e)
+{
+    std::cerr << "std::exception caught: " << e.what() << '\n';
+    return -1;
+}
@@ -0,0 +1,135 @@
+/*
+ * SPDX-FileCopyrightText: 2016 Dominik Wójt <domin144@o2.pl>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef BENCHMARK_RESULTS_H
+#define BENCHMARK_RESULTS_H
+
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*----------------------------------------------------------------------------*/
+/* Benchmark_result struct.
+ *
+ * One measurement, as a row of a CSV file. Runs on different commits are
+ * appended to the same file, or kept in separate files, and compared by the
+ * commit column. A hit rate is NaN, written as an empty field, where it
+ * doesn't apply. */
+/*----------------------------------------------------------------------------*/
+struct Benchmark_result
+{
+    std::string commit;
+    std::string benchmark;
+    std::string variant;
+    std::int64_t size;
+    /* in bytes, or keys for caches */
+    std::int64_t working_set;
+    int threads;
+    double ns_per_op;
+    double hit_rate;
+};
+
+const char benchmark_csv_header[] =
+        "commit,benchmark,variant,size,working_set,threads,ns_per_op,hit_rate";
+
+inline void write_result(std::ostream &out, const Benchmark_result &result)
+{
+    out
+            << result.commit << ','
+            << result.benchmark << ','
+            << result.variant << ','
+            << result.size << ','
+            << result.working_set << ','
+            << result.threads << ','
+            << result.ns_per_op << ',';
+    if(!std::isnan(result.hit_rate))
+        out << result.hit_rate;
+    out << '\n';
+}
+
+/* Appends to the file, with the header if the file is new. */
+inline void append_results(
+        const std::string &path,
+        const std::vector<Benchmark_result> &results)
+{
+    const bool exists = std::ifstream(path).good();
+    std::ofstream out(path, std::ios::app);
+    if(!out)
+        throw std::runtime_error("failed to open " + path);
+    if(!exists)
+        out << benchmark_csv_header << '\n';
+    for(const Benchmark_result &result : results)
+        write_result(out, result);
+    if(!out)
+        throw std::runtime_error("failed to write " + path);
+}
+
+/* The columns may come in any order, but all have to be present. */
+inline std::vector<Benchmark_result> read_results(const std::string &path)
+{
+    std::ifstream in(path);
+    if(!in)
+        throw std::runtime_error("failed to open " + path);
+
+    const auto split = [](const std::string &line)
+    {
+        std::vector<std::string> fields;
+        std::istringstream stream(line);
+        std::string field;
+        while(std::getline(stream, field, ','))
+            fields.push_back(field);
+        if(!line.empty() && line.back() == ',')
+            fields.emplace_back();
+        return fields;
+    };
+
+    std::string line;
+    if(!std::getline(in, line))
+        throw std::runtime_error("missing header in " + path);
+    const std::vector<std::string> header = split(line);
+    const auto column = [&](const std::string &name)
+    {
+        for(std::size_t i = 0; i < header.size(); ++i)
+            if(header[i] == name)
+                return i;
+        throw std::runtime_error("missing column " + name + " in " + path);
+    };
+    const std::size_t commit = column("commit");
+    const std::size_t benchmark = column("benchmark");
+    const std::size_t variant = column("variant");
+    const std::size_t size = column("size");
+    const std::size_t working_set = column("working_set");
+    const std::size_t threads = column("threads");
+    const std::size_t ns_per_op = column("ns_per_op");
+    const std::size_t hit_rate = column("hit_rate");
+
+    std::vector<Benchmark_result> result;
+    while(std::getline(in, line))
+    {
+        if(line.empty())
+            continue;
+        const std::vector<std::string> fields = split(line);
+        if(fields.size() != header.size())
+            throw std::runtime_error("invalid row in " + path + ": " + line);
+        result.push_back({
+            fields[commit],
+            fields[benchmark],
+            fields[variant],
+            std::stoll(fields[size]),
+            std::stoll(fields[working_set]),
+            std::stoi(fields[threads]),
+            std::stod(fields[ns_per_op]),
+            fields[hit_rate].empty() ? NAN : std::stod(fields[hit_rate])});
+    }
+    return result;
+}
+
+#endif /* BENCHMARK_RESULTS_H */
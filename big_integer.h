@@ -0,0 +1,471 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Dominik Wójt <domin144@o2.pl>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef BIG_INTEGER_H
+#define BIG_INTEGER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*----------------------------------------------------------------------------*/
+/* Big_integer class.
+ *
+ * Non-negative integer of any size. Limbs are in base 10^9, least significant
+ * first, without leading zero limbs, so printing in decimal is just
+ * formatting of the limbs.
+ *
+ * Multiplication picks the algorithm by the size of the operands: schoolbook
+ * for short ones, Karatsuba above karatsuba_threshold limbs and a number
+ * theoretic transform over three primes above ntt_threshold limbs. */
+/*----------------------------------------------------------------------------*/
+class Big_integer
+{
+public:
+    using Limb = std::uint32_t;
+    using Limbs = std::vector<Limb>;
+
+    static constexpr Limb base = 1000000000u;
+    static constexpr int base_digits = 9;
+    static constexpr std::size_t karatsuba_threshold = 40;
+    static constexpr std::size_t ntt_threshold = 2000;
+
+private:
+    Limbs m_limbs;
+
+public:
+    Big_integer() = default;
+
+    Big_integer(std::uint64_t value)
+    {
+        while(value != 0)
+        {
+            m_limbs.push_back(value % base);
+            value /= base;
+        }
+    }
+
+    explicit Big_integer(Limbs limbs) :
+        m_limbs(std::move(limbs))
+    {
+        trim(m_limbs);
+    }
+
+    const Limbs &limbs() const
+    {
+        return m_limbs;
+    }
+
+    std::size_t size() const
+    {
+        return m_limbs.size();
+    }
+
+    bool is_zero() const
+    {
+        return m_limbs.empty();
+    }
+
+    /* Multiplies by base^count. */
+    Big_integer shift_left(const std::size_t count) const
+    {
+        if(is_zero())
+            return {};
+        Limbs result(count, 0);
+        result.insert(result.end(), m_limbs.begin(), m_limbs.end());
+        return Big_integer(std::move(result));
+    }
+
+    /* Divides by base^count, rounding down. */
+    Big_integer shift_right(const std::size_t count) const
+    {
+        if(count >= m_limbs.size())
+            return {};
+        return Big_integer(Limbs(m_limbs.begin() + count, m_limbs.end()));
+    }
+
+    /* Divides by a small number, rounding down. */
+    Big_integer divide(const Limb divisor) const
+    {
+        Limbs result(m_limbs.size());
+        std::uint64_t remainder = 0;
+        for(std::size_t i = m_limbs.size(); i-- > 0;)
+        {
+            const std::uint64_t current = remainder * base + m_limbs[i];
+            result[i] = current / divisor;
+            remainder = current % divisor;
+        }
+        return Big_integer(std::move(result));
+    }
+
+    /* Decimal digits, without leading zeros. */
+    std::string to_string() const
+    {
+        if(is_zero())
+            return "0";
+        std::string result = std::to_string(m_limbs.back());
+        for(std::size_t i = m_limbs.size() - 1; i-- > 0;)
+        {
+            const std::string limb = std::to_string(m_limbs[i]);
+            result.append(base_digits - limb.size(), '0');
+            result.append(limb);
+        }
+        return result;
+    }
+
+    friend int compare(const Big_integer &lhs, const Big_integer &rhs)
+    {
+        if(lhs.size() != rhs.size())
+            return lhs.size() < rhs.size() ? -1 : 1;
+        for(std::size_t i = lhs.size(); i-- > 0;)
+        {
+            if(lhs.m_limbs[i] != rhs.m_limbs[i])
+                return lhs.m_limbs[i] < rhs.m_limbs[i] ? -1 : 1;
+        }
+        return 0;
+    }
+
+    friend Big_integer operator+(const Big_integer &lhs, const Big_integer &rhs)
+    {
+        Limbs result = lhs.m_limbs;
+        add_shifted(result, rhs.m_limbs, 0);
+        return Big_integer(std::move(result));
+    }
+
+    /* Requires lhs >= rhs. */
+    friend Big_integer operator-(const Big_integer &lhs, const Big_integer &rhs)
+    {
+        Limbs result = lhs.m_limbs;
+        subtract_in_place(result, rhs.m_limbs);
+        return Big_integer(std::move(result));
+    }
+
+    friend Big_integer operator*(const Big_integer &lhs, const Big_integer &rhs)
+    {
+        return Big_integer(multiply(lhs.m_limbs, rhs.m_limbs));
+    }
+
+    /* Product computed with the given algorithm regardless of the size, so
+     * big_integer_test can check the algorithms against each other. */
+    enum class Algorithm
+    {
+        schoolbook,
+        karatsuba,
+        ntt
+    };
+
+    static Big_integer multiply(
+            const Big_integer &lhs,
+            const Big_integer &rhs,
+            const Algorithm algorithm)
+    {
+        switch(algorithm)
+        {
+        case Algorithm::schoolbook:
+            return Big_integer(multiply_schoolbook(lhs.m_limbs, rhs.m_limbs));
+        case Algorithm::karatsuba:
+            return Big_integer(multiply_karatsuba(lhs.m_limbs, rhs.m_limbs));
+        case Algorithm::ntt:
+            return Big_integer(multiply_ntt(lhs.m_limbs, rhs.m_limbs));
+        }
+        return {};
+    }
+
+private:
+    static void trim(Limbs &limbs)
+    {
+        while(!limbs.empty() && limbs.back() == 0)
+            limbs.pop_back();
+    }
+
+    /* target += value * base^shift */
+    static void add_shifted(
+            Limbs &target,
+            const Limbs &value,
+            const std::size_t shift)
+    {
+        if(target.size() < shift + value.size())
+            target.resize(shift + value.size(), 0);
+        Limb carry = 0;
+        std::size_t i = 0;
+        for(; i < value.size(); ++i)
+        {
+            Limb sum = target[shift + i] + value[i] + carry;
+            carry = sum >= base;
+            if(carry)
+                sum -= base;
+            target[shift + i] = sum;
+        }
+        for(std::size_t j = shift + i; carry; ++j)
+        {
+            if(j == target.size())
+                target.push_back(0);
+            Limb sum = target[j] + carry;
+            carry = sum >= base;
+            if(carry)
+                sum -= base;
+            target[j] = sum;
+        }
+    }
+
+    /* target -= value, requires target >= value */
+    static void subtract_in_place(Limbs &target, const Limbs &value)
+    {
+        Limb borrow = 0;
+        std::size_t i = 0;
+        for(; i < value.size(); ++i)
+        {
+            const Limb subtrahend = value[i] + borrow;
+            borrow = target[i] < subtrahend;
+            target[i] = target[i] + (borrow ? base : 0) - subtrahend;
+        }
+        for(; borrow; ++i)
+        {
+            if(i == target.size())
+                throw std::logic_error("Big_integer subtraction underflow");
+            borrow = target[i] == 0;
+            target[i] = borrow ? base - 1 : target[i] - 1;
+        }
+        trim(target);
+    }
+
+    static Limbs multiply(const Limbs &lhs, const Limbs &rhs)
+    {
+        const std::size_t shorter = std::min(lhs.size(), rhs.size());
+        if(shorter == 0)
+            return {};
+        if(shorter < karatsuba_threshold)
+            return multiply_schoolbook(lhs, rhs);
+        if(shorter < ntt_threshold)
+            return multiply_karatsuba(lhs, rhs);
+        return multiply_ntt(lhs, rhs);
+    }
+
+    static Limbs multiply_schoolbook(const Limbs &lhs, const Limbs &rhs)
+    {
+        if(lhs.empty() || rhs.empty())
+            return {};
+        Limbs result(lhs.size() + rhs.size(), 0);
+        for(std::size_t i = 0; i < lhs.size(); ++i)
+        {
+            std::uint64_t carry = 0;
+            const std::uint64_t factor = lhs[i];
+            for(std::size_t j = 0; j < rhs.size(); ++j)
+            {
+                const std::uint64_t current =
+                        result[i + j] + factor * rhs[j] + carry;
+                result[i + j] = current % base;
+                carry = current / base;
+            }
+            result[i + rhs.size()] = carry;
+        }
+        trim(result);
+        return result;
+    }
+
+    /* Splits both operands at half of the longer one. When the shorter one
+     * doesn't reach the split point, only the longer one is split. */
+    static Limbs multiply_karatsuba(const Limbs &lhs, const Limbs &rhs)
+    {
+        const std::size_t shorter = std::min(lhs.size(), rhs.size());
+        if(shorter < karatsuba_threshold)
+            return multiply_schoolbook(lhs, rhs);
+        const std::size_t half = std::max(lhs.size(), rhs.size()) / 2;
+        auto low = [half](const Limbs &value)
+        {
+            Limbs result(
+                    value.begin(),
+                    value.begin() + std::min(half, value.size()));
+            trim(result);
+            return result;
+        };
+        auto high = [half](const Limbs &value)
+        {
+            if(value.size() <= half)
+                return Limbs();
+            return Limbs(value.begin() + half, value.end());
+        };
+
+        if(shorter <= half)
+        {
+            const Limbs &longer = lhs.size() > rhs.size() ? lhs : rhs;
+            const Limbs &other = lhs.size() > rhs.size() ? rhs : lhs;
+            Limbs result = multiply_karatsuba(low(longer), other);
+            add_shifted(result, multiply_karatsuba(high(longer), other), half);
+            trim(result);
+            return result;
+        }
+
+        const Limbs lhs_low = low(lhs);
+        const Limbs lhs_high = high(lhs);
+        const Limbs rhs_low = low(rhs);
+        const Limbs rhs_high = high(rhs);
+        const Limbs low_product = multiply_karatsuba(lhs_low, rhs_low);
+        const Limbs high_product = multiply_karatsuba(lhs_high, rhs_high);
+        Limbs lhs_sum = lhs_low;
+        add_shifted(lhs_sum, lhs_high, 0);
+        Limbs rhs_sum = rhs_low;
+        add_shifted(rhs_sum, rhs_high, 0);
+        Limbs middle = multiply_karatsuba(lhs_sum, rhs_sum);
+        subtract_in_place(middle, low_product);
+        subtract_in_place(middle, high_product);
+
+        Limbs result = low_product;
+        add_shifted(result, middle, half);
+        add_shifted(result, high_product, 2 * half);
+        trim(result);
+        return result;
+    }
+
+    static constexpr std::uint32_t power_mod(
+            std::uint64_t value,
+            std::uint64_t exponent,
+            const std::uint32_t modulus)
+    {
+        std::uint64_t result = 1;
+        value %= modulus;
+        while(exponent != 0)
+        {
+            if(exponent & 1)
+                result = result * value % modulus;
+            value = value * value % modulus;
+            exponent >>= 1;
+        }
+        return result;
+    }
+
+    /* In place transform of length 2^k, with 3 as the primitive root of
+     * every modulus used. */
+    template<std::uint32_t modulus>
+    static void ntt(std::vector<std::uint32_t> &values, const bool inverse)
+    {
+        const std::size_t size = values.size();
+        for(std::size_t i = 1, j = 0; i < size; ++i)
+        {
+            std::size_t bit = size >> 1;
+            for(; j & bit; bit >>= 1)
+                j ^= bit;
+            j ^= bit;
+            if(i < j)
+                std::swap(values[i], values[j]);
+        }
+        std::vector<std::uint32_t> roots;
+        for(std::size_t length = 2; length <= size; length <<= 1)
+        {
+            std::uint64_t root = power_mod(3, (modulus - 1) / length, modulus);
+            if(inverse)
+                root = power_mod(root, modulus - 2, modulus);
+            const std::size_t half = length / 2;
+            roots.resize(half);
+            roots[0] = 1;
+            for(std::size_t k = 1; k < half; ++k)
+                roots[k] = std::uint64_t(roots[k - 1]) * root % modulus;
+            for(std::size_t i = 0; i < size; i += length)
+            {
+                for(std::size_t k = 0; k < half; ++k)
+                {
+                    const std::uint32_t u = values[i + k];
+                    const std::uint32_t v =
+                            std::uint64_t(values[i + k + half]) * roots[k]
+                            % modulus;
+                    values[i + k] = u + v >= modulus ? u + v - modulus : u + v;
+                    values[i + k + half] = u >= v ? u - v : u + modulus - v;
+                }
+            }
+        }
+        if(inverse)
+        {
+            const std::uint64_t size_inverse =
+                    power_mod(size, modulus - 2, modulus);
+            for(std::uint32_t &value : values)
+                value = value * size_inverse % modulus;
+        }
+    }
+
+    /* Cyclic convolution modulo one prime, of length size. */
+    template<std::uint32_t modulus>
+    static std::vector<std::uint32_t> convolve(
+            const Limbs &lhs,
+            const Limbs &rhs,
+            const std::size_t size)
+    {
+        std::vector<std::uint32_t> lhs_values(size, 0);
+        std::vector<std::uint32_t> rhs_values(size, 0);
+        for(std::size_t i = 0; i < lhs.size(); ++i)
+            lhs_values[i] = lhs[i] % modulus;
+        for(std::size_t i = 0; i < rhs.size(); ++i)
+            rhs_values[i] = rhs[i] % modulus;
+        ntt<modulus>(lhs_values, false);
+        ntt<modulus>(rhs_values, false);
+        for(std::size_t i = 0; i < size; ++i)
+        {
+            lhs_values[i] =
+                    std::uint64_t(lhs_values[i]) * rhs_values[i] % modulus;
+        }
+        ntt<modulus>(lhs_values, true);
+        return lhs_values;
+    }
+
+    /* Coefficients of the product of two numbers of n limbs are below
+     * n * 10^18, the three moduli multiply to about 2^88, so the
+     * coefficients are recovered exactly by the Chinese remainder theorem up
+     * to 2^23 limbs, the longest transform the first modulus allows. */
+    static Limbs multiply_ntt(const Limbs &lhs, const Limbs &rhs)
+    {
+        constexpr std::uint32_t modulus_1 = 998244353; /* 119 * 2^23 + 1 */
+        constexpr std::uint32_t modulus_2 = 167772161; /* 5 * 2^25 + 1 */
+        constexpr std::uint32_t modulus_3 = 469762049; /* 7 * 2^26 + 1 */
+        if(lhs.empty() || rhs.empty())
+            return {};
+        const std::size_t result_size = lhs.size() + rhs.size();
+        std::size_t size = 1;
+        while(size < result_size)
+            size <<= 1;
+        if(size > (std::size_t(1) << 23))
+            throw std::length_error("Big_integer too long to multiply");
+
+        const std::vector<std::uint32_t> residues_1 =
+                convolve<modulus_1>(lhs, rhs, size);
+        const std::vector<std::uint32_t> residues_2 =
+                convolve<modulus_2>(lhs, rhs, size);
+        const std::vector<std::uint32_t> residues_3 =
+                convolve<modulus_3>(lhs, rhs, size);
+
+        /* Garner's algorithm */
+        constexpr std::uint64_t inverse_1_mod_2 =
+                power_mod(modulus_1, modulus_2 - 2, modulus_2);
+        constexpr std::uint64_t inverse_1_mod_3 =
+                power_mod(modulus_1, modulus_3 - 2, modulus_3);
+        constexpr std::uint64_t inverse_2_mod_3 =
+                power_mod(modulus_2, modulus_3 - 2, modulus_3);
+        constexpr unsigned __int128 modulus_1_2 =
+                std::uint64_t(modulus_1) * modulus_2;
+        Limbs result(result_size, 0);
+        unsigned __int128 carry = 0;
+        for(std::size_t i = 0; i < result_size; ++i)
+        {
+            const std::uint64_t x_1 = residues_1[i];
+            const std::uint64_t x_2 =
+                    (residues_2[i] + modulus_2 - x_1 % modulus_2)
+                    * inverse_1_mod_2 % modulus_2;
+            const std::uint64_t x_3 =
+                    ((residues_3[i] + modulus_3 - x_1 % modulus_3)
+                    * inverse_1_mod_3 % modulus_3
+                    + modulus_3 - x_2 % modulus_3)
+                    * inverse_2_mod_3 % modulus_3;
+            carry += x_1 + x_2 * modulus_1 + x_3 * modulus_1_2;
+            result[i] = carry % base;
+            carry /= base;
+        }
+        trim(result);
+        return result;
+    }
+};
+
+#endif /* BIG_INTEGER_H */
@@ -0,0 +1,102 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Dominik Wójt <domin144@o2.pl>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "big_integer.h"
+#include "utils.h"
+
+#include <cstddef>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+Big_integer random_integer(const std::size_t size, std::mt19937_64 &gen)
+{
+    std::uniform_int_distribution<Big_integer::Limb> limb(
+            0,
+            Big_integer::base - 1);
+    Big_integer::Limbs limbs(size);
+    for(Big_integer::Limb &value : limbs)
+        value = limb(gen);
+    /* no leading zero, so the size is as given */
+    if(size != 0 && limbs.back() == 0)
+        limbs.back() = 1;
+    return Big_integer(std::move(limbs));
+}
+
+/* All the limbs at their maximum, where the carries are the longest. */
+Big_integer all_nines(const std::size_t size)
+{
+    return Big_integer(Big_integer::Limbs(size, Big_integer::base - 1));
+}
+
+/* Every algorithm has to give the product the size would select. */
+void check_product(const Big_integer &lhs, const Big_integer &rhs)
+{
+    using Algorithm = Big_integer::Algorithm;
+    const Big_integer expected =
+            Big_integer::multiply(lhs, rhs, Algorithm::schoolbook);
+    my_assert(
+            compare(lhs * rhs, expected) == 0,
+            "operator* disagrees with schoolbook");
+    my_assert(
+            compare(
+                Big_integer::multiply(lhs, rhs, Algorithm::karatsuba),
+                expected) == 0,
+            "karatsuba disagrees with schoolbook");
+    my_assert(
+            compare(
+                Big_integer::multiply(lhs, rhs, Algorithm::ntt),
+                expected) == 0,
+            "ntt disagrees with schoolbook");
+}
+
+int main() try
+{
+    std::mt19937_64 gen(15);
+    const std::size_t k = Big_integer::karatsuba_threshold;
+    const std::size_t n = Big_integer::ntt_threshold;
+    const std::pair<std::size_t, std::size_t> sizes[] = {
+        {0, 5},
+        {1, 1},
+        {1, n + 1},
+        {k - 1, k - 1},
+        {k, k},
+        {k + 1, k + 1},
+        {k - 1, 3 * k},
+        {k + 1, 3 * k},
+        {2 * k + 1, 7 * k},
+        {n - 1, n - 1},
+        {n, n},
+        {n + 1, n + 1},
+        {k, n + 1}};
+    for(const auto &size : sizes)
+    {
+        check_product(
+                random_integer(size.first, gen),
+                random_integer(size.second, gen));
+        check_product(all_nines(size.first), all_nines(size.second));
+    }
+
+    /* (10^(9 s) - 1)^2 = 10^(18 s) - 2 * 10^(9 s) + 1 */
+    const std::size_t size = n + 1;
+    const std::size_t digits = size * Big_integer::base_digits;
+    const std::string expected =
+            std::string(digits - 1, '9') + '8'
+            + std::string(digits - 1, '0') + '1';
+    my_assert(
+            (all_nines(size) * all_nines(size)).to_string() == expected,
+            "wrong square of all nines");
+
+    std::cout << "big integer products ok\n";
+    return 0;
+}
+catch(std::exception &e)
+{
+    std::cerr << "std::exception caught: " << e.what() << '\n';
+    return -1;
+}
@@ -9,8 +9,10 @@
 
 #include "trees_and_heaps.h"
 
+#include <cstdint>
 #include <map>
 #include <limits>
+#include <type_traits>
 
 /*----------------------------------------------------------------------------*/
 /* Cache class.
@@ -23,33 +25,74 @@
  * without registering a reference using get function.
  *
  * Pointer push, pop, reference and get have logarithmic complexity in
- * the number of pointers being held. */
+ * the number of pointers being held.
+ *
+ * A key has to be absent to be pushed, and present to be updated, and
+ * the cache can't be popped when empty or pushed when full. These are
+ * checked only when NDEBUG is not defined.
+ *
+ * The time of the last reference is read from a clock counting references,
+ * which wraps around and is compared modulo its range. A 64-bit clock never
+ * wraps in practice. A narrower one packs with a small key, so with int keys
+ * a slot takes 24 bytes instead of 32, but then the ages of
+ * the pointers are kept from reaching half of the range: every reference
+ * checks a few of the slots, and makes the ones older than max_exact_age
+ * just one reference older than that. Pointers referenced within
+ * max_exact_age references are removed in the exact order, and only after
+ * the older ones, which are removed in no particular order. */
 /*----------------------------------------------------------------------------*/
-template<typename TKey, typename TData>
+template<typename TKey, typename TData, typename TTime = std::uint64_t>
 class Cache
 {
 public:
     using Key = TKey;
     using Data = TData;
-    using Time = int;
+    using Time = TTime;
+
+    static_assert(std::is_unsigned<Time>::value, "Time has to wrap around");
+
+    static constexpr Time max_exact_age = std::numeric_limits<Time>::max() / 4;
+
+private:
+    static constexpr bool m_narrow_time =
+            std::numeric_limits<Time>::digits < 64;
 
 private:
+    /* the narrow fields last, so a narrow Time fills the padding after
+     * a small Key */
     struct Slot
     {
-        Index m_index_in_heap = -1;
-        Time m_last_reference = 0;
         Data *m_data = nullptr;
+        Index m_index_in_heap = -1;
         Key m_key;
+        Time m_last_reference = 0;
     };
 
+public:
+    static constexpr std::size_t slot_size = sizeof(Slot);
+
+private:
+
     struct Heap_element
     {
         Slot *m_slot;
 
-        /* comparison by time of last reference */
+        /* comparison by time of last reference, modulo the range of Time
+         * for narrow clocks */
         bool operator<(const Heap_element& rhs) const
         {
-            return m_slot->m_last_reference < rhs.m_slot->m_last_reference;
+            const Time lhs_time = m_slot->m_last_reference;
+            const Time rhs_time = rhs.m_slot->m_last_reference;
+            if constexpr(m_narrow_time)
+            {
+                const Time difference = rhs_time - lhs_time;
+                return difference != 0
+                        && difference <= std::numeric_limits<Time>::max() / 2;
+            }
+            else
+            {
+                return lhs_time < rhs_time;
+            }
         }
 
         bool operator>(const Heap_element& rhs) const
@@ -70,11 +113,18 @@ private:
     Heap<Heap_element, std::greater<Heap_element> > m_heap;
     std::vector<Slot *> m_free_slots;
     Time m_time;
+    /* for narrow clocks, the next slot to check and how many are checked on
+     * every reference, so every slot is checked within max_exact_age
+     * references */
+    Index m_age_cursor;
+    Index m_slots_per_reference;
 
 public:
     Cache(const Index cache_size) :
         m_slots(cache_size),
-        m_time(0)
+        m_time(0),
+        m_age_cursor(0),
+        m_slots_per_reference(1 + cache_size / max_exact_age)
     {
         m_heap.reserve(cache_size);
 
@@ -100,8 +150,8 @@ public:
 
     void update_key(const Key key)
     {
-        Data *data = get_or_update(key, true);
-        my_assert(data, "trying to update absent key");
+        [[maybe_unused]] Data *const data = get_or_update(key, true);
+        my_debug_assert(data, "trying to update absent key");
     }
 
     /* more efficient if done at once */
@@ -112,10 +162,10 @@ public:
 
     Data *pop()
     {
-        my_assert(m_map.size() != 0, "trying to pop empty cache");
+        my_debug_assert(m_map.size() != 0, "trying to pop empty cache");
         const Heap_element heap_element = m_heap.pop();
         Slot *const slot = heap_element.m_slot;
-        my_assert(
+        my_debug_assert(
                     slot->m_index_in_heap == m_heap.get_size(),
                     "invalid index in heap");
 
@@ -129,40 +179,36 @@ public:
         *slot = Slot();
         m_free_slots.push_back(slot);
 
-        const Index map_size = m_map.size();
-        my_assert(map_size == m_heap.get_size(), "heap - map size mismatch");
+        my_debug_assert(
+                    static_cast<Index>(m_map.size()) == m_heap.get_size(),
+                    "heap - map size mismatch");
 
         return result;
     }
 
     void push(const TKey key, Data *const data)
     {
-        if(m_map.find(key) != m_map.end())
-        {
-            my_assert(false, "trying to push data already present in cache");
-        }
-        else
-        {
-            const Index current_size = m_map.size();
-            my_assert(
-                        current_size < get_cache_size(),
-                        "trying to push more data than cache can hold");
+        my_debug_assert(
+                    m_map.find(key) == m_map.end(),
+                    "trying to push data already present in cache");
+        my_debug_assert(
+                    static_cast<Index>(m_map.size()) < get_cache_size(),
+                    "trying to push more data than cache can hold");
 
-            Slot *const slot = m_free_slots.back();
-            m_free_slots.pop_back();
+        Slot *const slot = m_free_slots.back();
+        m_free_slots.pop_back();
 
-            m_map[key] = slot;
+        m_map[key] = slot;
 
-            slot->m_data = data;
-            slot->m_key = key;
+        slot->m_data = data;
+        slot->m_key = key;
 
-            slot->m_index_in_heap = m_heap.get_size();
-            Heap_element heap_element;
-            heap_element.m_slot = slot;
-            m_heap.push(heap_element);
+        slot->m_index_in_heap = m_heap.get_size();
+        Heap_element heap_element;
+        heap_element.m_slot = slot;
+        m_heap.push(heap_element);
 
-            update(slot);
-        }
+        update(slot);
     }
 
     bool is_full() const
@@ -201,16 +247,28 @@ private:
 
     void increment_time()
     {
-        if(m_time == std::numeric_limits<Time>::max())
+        m_time++;
+        if constexpr(m_narrow_time)
+            limit_ages();
+    }
+
+    /* Between the checks of a slot its age grows by max_exact_age at most,
+     * so it stays within half of the range of Time. Making a pointer younger
+     * moves it in the heap, in logarithmic time. */
+    void limit_ages()
+    {
+        for(Index i = 0; i < m_slots_per_reference; ++i)
         {
-            Time span = m_map.size();
-            Time oldest_reference = m_time - span + 1;
-            for(Slot &slot : m_slots)
-                if(slot.m_data)
-                    slot.m_last_reference -= oldest_reference;
-            m_time -= oldest_reference;
+            Slot &slot = m_slots[m_age_cursor];
+            if(++m_age_cursor == static_cast<Index>(m_slots.size()))
+                m_age_cursor = 0;
+            const Time age = m_time - slot.m_last_reference;
+            if(slot.m_data && age > max_exact_age)
+            {
+                slot.m_last_reference = m_time - max_exact_age - 1;
+                m_heap.update(slot.m_index_in_heap);
+            }
         }
-        m_time++;
     }
 };
 
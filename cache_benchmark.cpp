@@ -0,0 +1,311 @@
+/*
+ * SPDX-FileCopyrightText: 2016 Dominik Wójt <domin144@o2.pl>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "benchmark_results.h"
+#include "cache.h"
+#include "cache_test_reference.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+template<typename Function>
+double measure_ns(Function &&function)
+{
+    const auto start = std::chrono::steady_clock::now();
+    function();
+    const std::chrono::duration<double, std::nano> elapsed =
+            std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+std::vector<Benchmark_result> benchmark_heap_sort(const std::string &commit)
+{
+    std::vector<Benchmark_result> results;
+    for(const Index n : {1000, 10000, 100000, 1000000})
+    {
+        std::vector<int> data(n);
+        randomize(data.begin(), data.end(), 15);
+        std::vector<int> test = data;
+        const double custom_ns = measure_ns(
+                [&]()
+                {
+                    my_make_heap(test.begin(), test.end(), std::less<int>());
+                    my_sort_heap(test.begin(), test.end(), std::less<int>());
+                });
+        test = data;
+        const double std_ns = measure_ns(
+                [&]()
+                {
+                    std::make_heap(test.begin(), test.end(), std::less<int>());
+                    std::sort_heap(test.begin(), test.end(), std::less<int>());
+                });
+        const Index working_set = n * sizeof(int);
+        results.push_back(
+                {commit, "heap_sort", "custom", n, working_set, 1,
+                    custom_ns / n, NAN});
+        results.push_back(
+                {commit, "heap_sort", "std", n, working_set, 1,
+                    std_ns / n, NAN});
+    }
+    return results;
+}
+
+template<typename Time>
+bool is_full(const Cache<int, int, Time> &cache)
+{
+    return cache.is_full();
+}
+
+bool is_full(const Primitive_cache<int> &cache)
+{
+    return cache.full();
+}
+
+/* Looks the keys up, producing the missing resources like cache_test.
+ * Returns the number of hits. */
+template<typename Cache_type>
+Index run_cache(
+        const Index cache_size,
+        const std::vector<int> &keys,
+        std::vector<int> &resources)
+{
+    Cache_type cache(cache_size);
+    Index hits = 0;
+    for(const int key : keys)
+    {
+        int *sought_resource = cache.get_and_update(key);
+        if(sought_resource)
+        {
+            ++hits;
+            continue;
+        }
+        if(is_full(cache))
+            sought_resource = cache.pop();
+        else
+            sought_resource = &resources[key % cache_size];
+        cache.push(key, sought_resource);
+    }
+    return hits;
+}
+
+/* Every thread runs its own cache on its own keys, so the time per operation
+ * stays flat while the threads don't compete for memory bandwidth. */
+template<typename Cache_type>
+Benchmark_result benchmark_cache(
+        const std::string &commit,
+        const std::string &variant,
+        const Index cache_size,
+        const int key_range,
+        const int thread_count)
+{
+    const Index operation_count = 5 * cache_size;
+    std::vector<std::vector<int>> keys(thread_count);
+    std::vector<std::vector<int>> resources(thread_count);
+    std::vector<Index> hits(thread_count);
+    for(int i = 0; i < thread_count; ++i)
+    {
+        keys[i].resize(operation_count);
+        randomize(keys[i].begin(), keys[i].end(), 15 + i, key_range);
+        resources[i].resize(cache_size);
+    }
+
+    const double ns = measure_ns(
+            [&]()
+            {
+                std::vector<std::thread> threads;
+                for(int i = 0; i < thread_count; ++i)
+                    threads.emplace_back(
+                            [&, i]()
+                            {
+                                hits[i] = run_cache<Cache_type>(
+                                        cache_size,
+                                        keys[i],
+                                        resources[i]);
+                            });
+                for(std::thread &thread : threads)
+                    thread.join();
+            });
+
+    Index total_hits = 0;
+    for(const Index thread_hits : hits)
+        total_hits += thread_hits;
+    return {
+        commit,
+        "cache",
+        variant,
+        cache_size,
+        key_range,
+        thread_count,
+        ns / operation_count,
+        static_cast<double>(total_hits) / (operation_count * thread_count)};
+}
+
+std::vector<Benchmark_result> benchmark_caches(const std::string &commit)
+{
+    std::vector<Benchmark_result> results;
+    for(const Index cache_size : {100, 1000, 10000})
+    {
+        /* key ranges of 1.25, 2 and 4 times the cache size */
+        for(const int key_range_quarters : {5, 8, 16})
+        {
+            const int key_range =
+                    static_cast<int>(cache_size * key_range_quarters / 4);
+            for(const int threads : {1, 2, 4})
+            {
+                results.push_back(
+                        benchmark_cache<Cache<int, int>>(
+                            commit, "Cache", cache_size, key_range, threads));
+                results.push_back(
+                        benchmark_cache<Primitive_cache<int>>(
+                            commit,
+                            "Primitive_cache",
+                            cache_size,
+                            key_range,
+                            threads));
+            }
+        }
+    }
+    return results;
+}
+
+/* Times every reference on its own, to find the rare slow ones. A 16-bit
+ * clock wraps around every 65536 references. The same references are run
+ * a few times, and the shortest time of each is kept, so preemptions, which
+ * hit random references, are filtered out and what a reference costs every
+ * time stays. */
+template<typename Time>
+void benchmark_tail_latency(
+        const std::string &commit,
+        const std::string &clock,
+        const Index cache_size,
+        std::vector<Benchmark_result> &results)
+{
+    using Clock = std::chrono::steady_clock;
+    const Index operation_count = 1 << 20;
+    const int run_count = 3;
+    const int key_range = static_cast<int>(2 * cache_size);
+    std::vector<int> keys(operation_count);
+    randomize(keys.begin(), keys.end(), 15, key_range);
+    std::vector<int> resources(cache_size);
+    std::vector<float> latencies(
+            operation_count,
+            std::numeric_limits<float>::infinity());
+
+    Index hits = 0;
+    for(int run = 0; run < run_count; ++run)
+    {
+        Cache<int, int, Time> cache(cache_size);
+        hits = 0;
+        for(Index i = 0; i < operation_count; ++i)
+        {
+            const int key = keys[i];
+            const Clock::time_point start = Clock::now();
+            int *sought_resource = cache.get_and_update(key);
+            if(sought_resource)
+            {
+                ++hits;
+            }
+            else
+            {
+                if(cache.is_full())
+                    sought_resource = cache.pop();
+                else
+                    sought_resource = &resources[key % cache_size];
+                cache.push(key, sought_resource);
+            }
+            const std::chrono::duration<float, std::nano> latency =
+                    Clock::now() - start;
+            latencies[i] = std::min(latencies[i], latency.count());
+        }
+    }
+
+    const double hit_rate = static_cast<double>(hits) / operation_count;
+    const std::pair<const char *, double> quantiles[] = {
+        {"p50", 0.5},
+        {"p99", 0.99},
+        {"p99.99", 0.9999},
+        {"p99.999", 0.99999},
+        {"max", 1}};
+    for(const auto &quantile : quantiles)
+    {
+        const auto position =
+                latencies.begin()
+                + static_cast<Index>(quantile.second * (operation_count - 1));
+        std::nth_element(latencies.begin(), position, latencies.end());
+        results.push_back(
+                {commit,
+                    "cache_tail_latency",
+                    clock + " " + quantile.first,
+                    cache_size,
+                    key_range,
+                    1,
+                    *position,
+                    hit_rate});
+    }
+}
+
+std::vector<Benchmark_result> benchmark_tail_latencies(
+        const std::string &commit)
+{
+    std::vector<Benchmark_result> results;
+    for(const Index cache_size : {1000, 10000, 100000})
+    {
+        benchmark_tail_latency<std::uint64_t>(
+                commit, "64-bit", cache_size, results);
+        benchmark_tail_latency<std::uint32_t>(
+                commit, "32-bit", cache_size, results);
+        benchmark_tail_latency<std::uint16_t>(
+                commit, "16-bit", cache_size, results);
+    }
+    return results;
+}
+
+/* The results are printed as CSV, or appended to the file for
+ * benchmark_plot. */
+int main(const int argc, const char *const argv[]) try
+{
+    if(argc != 1 && argc != 3)
+        throw std::runtime_error(
+                "usage: cache_benchmark [RESULTS_CSV COMMIT]");
+    const std::string commit = argc == 3 ? argv[2] : "current";
+
+    std::vector<Benchmark_result> results = benchmark_heap_sort(commit);
+    const std::vector<Benchmark_result> cache_results =
+            benchmark_caches(commit);
+    results.insert(results.end(), cache_results.begin(), cache_results.end());
+    const std::vector<Benchmark_result> latency_results =
+            benchmark_tail_latencies(commit);
+    results.insert(
+            results.end(),
+            latency_results.begin(),
+            latency_results.end());
+
+    if(argc == 3)
+    {
+        append_results(argv[1], results);
+    }
+    else
+    {
+        std::cout << benchmark_csv_header << '\n';
+        for(const Benchmark_result &result : results)
+            write_result(std::cout, result);
+    }
+    return 0;
+}
+catch(std::runtime_error &e)
+{
+    std::cerr << "runtime error caught: " << e.what() << std::endl;
+    return -1;
+}
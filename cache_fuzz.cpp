@@ -0,0 +1,227 @@
+/*
+ * SPDX-FileCopyrightText: 2016 Dominik Wójt <domin144@o2.pl>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "cache.h"
+#include "fuzz_driver.h"
+
+#include <algorithm>
+#include <iterator>
+#include <list>
+#include <stdexcept>
+
+/*----------------------------------------------------------------------------*/
+/* Reference_cache class.
+ *
+ * The model Cache is checked against: a list ordered from the most recently
+ * referenced key to the least recently referenced one, with the number of
+ * the last reference. */
+/*----------------------------------------------------------------------------*/
+class Reference_cache
+{
+    struct Entry
+    {
+        int key;
+        int *data;
+        Index last_reference;
+    };
+
+    Index m_cache_size;
+    std::list<Entry> m_entries;
+    Index m_time;
+public:
+    Reference_cache(const Index cache_size) :
+        m_cache_size(cache_size),
+        m_time(0)
+    {
+    }
+
+    Index size() const
+    {
+        return m_entries.size();
+    }
+
+    bool full() const
+    {
+        return size() == m_cache_size;
+    }
+
+    bool contains(const int key) const
+    {
+        return find(key) != m_entries.end();
+    }
+
+    int *get(const int key, const bool update)
+    {
+        const auto entry = find(key);
+        if(entry == m_entries.end())
+            return nullptr;
+        if(update)
+        {
+            m_entries.splice(m_entries.begin(), m_entries, entry);
+            m_entries.front().last_reference = m_time++;
+        }
+        return entry->data;
+    }
+
+    /* Removes the entry of the data popped from the cache. It has to be
+     * the least recently referenced one, unless it was not referenced within
+     * exact_age references. */
+    bool pop(int *const data, const Index exact_age)
+    {
+        const auto entry = std::find_if(
+                m_entries.begin(),
+                m_entries.end(),
+                [data](const Entry &entry) { return entry.data == data; });
+        if(entry == m_entries.end())
+            return false;
+        const bool valid =
+                std::next(entry) == m_entries.end()
+                || m_time - entry->last_reference > exact_age;
+        m_entries.erase(entry);
+        return valid;
+    }
+
+    void push(const int key, int *const data)
+    {
+        m_entries.push_front({key, data, m_time++});
+    }
+private:
+    std::list<Entry>::const_iterator find(const int key) const
+    {
+        return std::find_if(
+                m_entries.begin(),
+                m_entries.end(),
+                [key](const Entry &entry) { return entry.key == key; });
+    }
+};
+
+/* Expects the call to be rejected by a debug check, where they are compiled
+ * in. Without them the call would break the cache, so it is skipped. */
+template<typename Function>
+void check_rejected(Function &&function, const char *const description)
+{
+#ifndef NDEBUG
+    bool rejected = false;
+    try
+    {
+        function();
+    }
+    catch(std::runtime_error &)
+    {
+        rejected = true;
+    }
+    my_assert(rejected, description);
+#else
+    static_cast<void>(function);
+    static_cast<void>(description);
+#endif
+}
+
+/* Every key has its own resource, so the popped resource tells the key. */
+template<typename Time>
+void check_cache(Fuzz_input input, const Index cache_size)
+{
+    const int key_range = 32;
+    Cache<int, int, Time> cache(cache_size);
+    Reference_cache reference(cache_size);
+    int resources[key_range];
+
+    while(!input.empty())
+    {
+        const int operation = input.next() % 5;
+        const int key = input.next() % key_range;
+        switch(operation)
+        {
+        case 0:
+        {
+            int *const resource = &resources[key];
+            if(reference.contains(key))
+            {
+                check_rejected(
+                        [&]() { cache.push(key, resource); },
+                        "push of a present key accepted");
+            }
+            else if(reference.full())
+            {
+                check_rejected(
+                        [&]() { cache.push(key, resource); },
+                        "push into a full cache accepted");
+            }
+            else
+            {
+                cache.push(key, resource);
+                reference.push(key, resource);
+            }
+            break;
+        }
+        case 1:
+            if(reference.size() == 0)
+            {
+                check_rejected(
+                        [&]() { cache.pop(); },
+                        "pop of an empty cache accepted");
+            }
+            else
+            {
+                my_assert(
+                        reference.pop(
+                            cache.pop(),
+                            Cache<int, int, Time>::max_exact_age),
+                        "pop of a wrong resource");
+            }
+            break;
+        case 2:
+            my_assert(
+                    cache.get(key) == reference.get(key, false),
+                    "get of a wrong resource");
+            break;
+        case 3:
+            my_assert(
+                    cache.get_and_update(key) == reference.get(key, true),
+                    "get_and_update of a wrong resource");
+            break;
+        case 4:
+            if(reference.contains(key))
+            {
+                cache.update_key(key);
+                reference.get(key, true);
+            }
+            else
+            {
+                check_rejected(
+                        [&]() { cache.update_key(key); },
+                        "update of an absent key accepted");
+            }
+            break;
+        }
+
+        my_assert(
+                cache.get_used_slots_count() == reference.size(),
+                "wrong number of used slots");
+        my_assert(cache.is_full() == reference.full(), "wrong is_full");
+        my_assert(
+                cache.is_empty() == (reference.size() == 0),
+                "wrong is_empty");
+    }
+}
+
+/* The first byte is the cache size and the clock, every next one
+ * an operation, with the key in the following byte. Small caches and few
+ * keys make evictions and repeated keys common, and the 8-bit clock wraps
+ * around often. */
+extern "C" int LLVMFuzzerTestOneInput(
+        const std::uint8_t *const data,
+        const std::size_t size)
+{
+    Fuzz_input input(data, size);
+    const std::uint8_t parameters = input.next();
+    const Index cache_size = 1 + parameters % 16;
+    if(parameters & 0x80)
+        check_cache<std::uint8_t>(input, cache_size);
+    else
+        check_cache<std::uint64_t>(input, cache_size);
+    return 0;
+}
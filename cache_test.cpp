@@ -5,180 +5,23 @@
  */
 
 #include "cache.h"
+#include "cache_test_reference.h"
 
+#include <cstdint>
 #include <iostream>
 #include <stdexcept>
-#include <random>
 #include <utility>
-#include <chrono>
+#include <vector>
 
-template<typename Iterator>
-void randomize(
-        Iterator begin,
-        Iterator end,
-        const int seed,
-        const int range = 1000000)
-{
-    std::mt19937 gen(seed);
-    std::uniform_int_distribution<> dis(0, range - 1);
-    for(auto i = begin; i != end; ++i)
-    {
-        *i = dis(gen);
-    }
-}
-
-template<typename TData>
-class Primitive_cache
-{
-public:
-    using Data = TData;
-    using Key = int;
-    using Time = int;
-
-private:
-    struct Slot
-    {
-        Key m_key = -1;
-        Time m_age = -1;
-        Data *m_data = nullptr;
-    };
-
-private:
-    std::vector<Slot> m_slots;
-
-public:
-    Primitive_cache(const Index cache_size) :
-        m_slots(cache_size)
-    { }
-
-    Index get_cache_size() const
-    {
-        return m_slots.size();
-    }
-
-    Data *get(const Key key)
-    {
-        return get_or_update(key, false);
-    }
-
-    void update_key(const Key key)
-    {
-        Data *data = get_or_update(key, true);
-        my_assert(data, "trying to update absent key");
-    }
-
-    /* more efficient if done at once */
-    Data *get_and_update(const Key key)
-    {
-        return get_or_update(key, true);
-    }
-
-    Data *pop()
-    {
-        auto iter =
-                std::max_element(
-                    m_slots.begin(),
-                    m_slots.end(),
-                    [](const Slot lhs, const Slot rhs)
-                    {
-                        return lhs.m_age < rhs.m_age;
-                    });
-        Slot &slot = *iter;
-
-        my_assert(slot.m_data, "trying to pop empty cache");
-
-        Data *const result = slot.m_data;
-        slot = Slot();
-
-        return result;
-    }
-
-    void push(const Key key, Data *const data)
-    {
-        auto iter =
-                std::find_if(
-                    m_slots.begin(),
-                    m_slots.end(),
-                    [key](const Slot slot)
-                    {
-                        return slot.m_key == key;
-                    });
-        if(iter != m_slots.end())
-        {
-            my_assert(false, "trying to push data already present in cache");
-        }
-        else
-        {
-            auto empty_iter =
-                    std::find_if(
-                        m_slots.begin(),
-                        m_slots.end(),
-                        [](const Slot slot)
-                        {
-                            return slot.m_data == nullptr;
-                        });
-            my_assert(
-                        empty_iter != m_slots.end(),
-                        "trying to push more data than cache can hold");
-
-            Slot &slot = *empty_iter;
-            slot.m_data = data;
-            slot.m_key = key;
-            update(slot);
-        }
-    }
-
-    bool full() const
-    {
-        auto empty_iter =
-                std::find_if(
-                    m_slots.begin(),
-                    m_slots.end(),
-                    [](const Slot slot)
-                    {
-                        return slot.m_data == nullptr;
-                    });
-        return empty_iter == m_slots.end();
-    }
-
-private:
-    Data *get_or_update(const Key key, bool do_update)
-    {
-        auto iter =
-                std::find_if(
-                    m_slots.begin(),
-                    m_slots.end(),
-                    [key](const Slot slot)
-                    {
-                        return slot.m_key == key;
-                    });
-        if(iter != m_slots.end())
-        {
-            Slot &slot = *iter;
-            if(do_update)
-                update(slot);
-            return slot.m_data;
-        }
-        else
-        {
-            return nullptr;
-        }
-    }
-
-    void update(Slot &slot)
-    {
-        increment_time();
-        slot.m_age = 0;
-    }
-
-    void increment_time()
-    {
-        for(Slot &slot : m_slots)
-            if(slot.m_data)
-                slot.m_age++;
-    }
-};
+/* a narrow clock is only worth its cost if the slots get smaller */
+static_assert(
+        Cache<int, int, std::uint32_t>::slot_size < Cache<int, int>::slot_size,
+        "32-bit clock doesn't shrink the slots");
+static_assert(
+        Cache<int, int, std::uint16_t>::slot_size < Cache<int, int>::slot_size,
+        "16-bit clock doesn't shrink the slots");
 
+/* The timings are in cache_benchmark. */
 int main() try
 {
     std::cout << "Hello!\n";
@@ -191,62 +34,27 @@ int main() try
             randomize(test_std.begin(), test_std.end(), seed);
             std::vector<int> test_custom = test_std;
 
-            {
-                Timer std_timer("custom");
-                my_make_heap(
-                            test_custom.begin(),
-                            test_custom.end(),
-                            std::less<int>());
-                my_sort_heap(
-                            test_custom.begin(),
-                            test_custom.end(),
-                            std::less<int>());
-            }
-
-            {
-                Timer std_timer("std");
-                std::make_heap(
-                            test_std.begin(),
-                            test_std.end(),
-                            std::less<int>());
-                std::sort_heap(
-                            test_std.begin(),
-                            test_std.end(),
-                            std::less<int>());
-            }
-
-            {
-                Timer std_timer("custom");
-                my_make_heap(
-                            test_custom.begin(),
-                            test_custom.end(),
-                            std::less<int>());
-                my_sort_heap(
-                            test_custom.begin(),
-                            test_custom.end(),
-                            std::less<int>());
-            }
-
-            {
-                Timer std_timer("std");
-                std::make_heap(
-                            test_std.begin(),
-                            test_std.end(),
-                            std::less<int>());
-                std::sort_heap(
-                            test_std.begin(),
-                            test_std.end(),
-                            std::less<int>());
-            }
-
-            if(test_std == test_custom)
-                std::cerr << "test OK\n";
-            else
-                std::cerr << "test fail\n";
+            my_make_heap(
+                        test_custom.begin(),
+                        test_custom.end(),
+                        std::less<int>());
+            my_sort_heap(
+                        test_custom.begin(),
+                        test_custom.end(),
+                        std::less<int>());
+            std::make_heap(
+                        test_std.begin(),
+                        test_std.end(),
+                        std::less<int>());
+            std::sort_heap(
+                        test_std.begin(),
+                        test_std.end(),
+                        std::less<int>());
+
+            my_assert(test_std == test_custom, "heap sort test failed!");
         }
     }
 
-
     {
         const int cache_size = 10000;
         const int key_range = 20000;
@@ -262,7 +70,6 @@ int main() try
         primitive_results.reserve(5 * cache_size);
 
         {
-            Timer timer("advanced");
             Cache<int, int> advanced_cache(cache_size);
             for(int test : tests)
             {
@@ -287,7 +94,6 @@ int main() try
         }
 
         {
-            Timer timer("primitive");
             Primitive_cache<int> primitive_cache(cache_size);
             for(int test : tests)
             {
@@ -311,10 +117,9 @@ int main() try
             }
         }
 
-        if(advanced_results == primitive_results)
-            std::cerr << "Cache test passed!\n";
-        else
-            std::cerr << "Cache test failed!\n";
+        my_assert(
+                    advanced_results == primitive_results,
+                    "Cache test failed!");
     }
 
     {
@@ -356,6 +161,8 @@ int main() try
             /* use the resource */
         }
 
+        /* the check is compiled only into debug builds */
+#ifndef NDEBUG
         bool test_passed = false;
         try
         {
@@ -366,6 +173,7 @@ int main() try
             test_passed = true;
         }
         my_assert(test_passed, "push over cache size succeeded!");
+#endif
     }
 
     std::cout << "Bye!\n";
@@ -0,0 +1,190 @@
+/*
+ * SPDX-FileCopyrightText: 2016 Dominik Wójt <domin144@o2.pl>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef CACHE_TEST_REFERENCE_H
+#define CACHE_TEST_REFERENCE_H
+
+#include "cache.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+template<typename Iterator>
+void randomize(
+        Iterator begin,
+        Iterator end,
+        const int seed,
+        const int range = 1000000)
+{
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<> dis(0, range - 1);
+    for(auto i = begin; i != end; ++i)
+    {
+        *i = dis(gen);
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/* Primitive_cache class.
+ *
+ * The same interface as Cache, with linear searches over the slots. It is the
+ * reference the tests compare Cache with, and the baseline of the benchmarks.
+ */
+/*----------------------------------------------------------------------------*/
+template<typename TData>
+class Primitive_cache
+{
+public:
+    using Data = TData;
+    using Key = int;
+    using Time = int;
+
+private:
+    struct Slot
+    {
+        Key m_key = -1;
+        Time m_age = -1;
+        Data *m_data = nullptr;
+    };
+
+private:
+    std::vector<Slot> m_slots;
+
+public:
+    Primitive_cache(const Index cache_size) :
+        m_slots(cache_size)
+    { }
+
+    Index get_cache_size() const
+    {
+        return m_slots.size();
+    }
+
+    Data *get(const Key key)
+    {
+        return get_or_update(key, false);
+    }
+
+    void update_key(const Key key)
+    {
+        Data *data = get_or_update(key, true);
+        my_assert(data, "trying to update absent key");
+    }
+
+    /* more efficient if done at once */
+    Data *get_and_update(const Key key)
+    {
+        return get_or_update(key, true);
+    }
+
+    Data *pop()
+    {
+        auto iter =
+                std::max_element(
+                    m_slots.begin(),
+                    m_slots.end(),
+                    [](const Slot lhs, const Slot rhs)
+                    {
+                        return lhs.m_age < rhs.m_age;
+                    });
+        Slot &slot = *iter;
+
+        my_assert(slot.m_data, "trying to pop empty cache");
+
+        Data *const result = slot.m_data;
+        slot = Slot();
+
+        return result;
+    }
+
+    void push(const Key key, Data *const data)
+    {
+        auto iter =
+                std::find_if(
+                    m_slots.begin(),
+                    m_slots.end(),
+                    [key](const Slot slot)
+                    {
+                        return slot.m_key == key;
+                    });
+        if(iter != m_slots.end())
+        {
+            my_assert(false, "trying to push data already present in cache");
+        }
+        else
+        {
+            auto empty_iter =
+                    std::find_if(
+                        m_slots.begin(),
+                        m_slots.end(),
+                        [](const Slot slot)
+                        {
+                            return slot.m_data == nullptr;
+                        });
+            my_assert(
+                        empty_iter != m_slots.end(),
+                        "trying to push more data than cache can hold");
+
+            Slot &slot = *empty_iter;
+            slot.m_data = data;
+            slot.m_key = key;
+            update(slot);
+        }
+    }
+
+    bool full() const
+    {
+        auto empty_iter =
+                std::find_if(
+                    m_slots.begin(),
+                    m_slots.end(),
+                    [](const Slot slot)
+                    {
+                        return slot.m_data == nullptr;
+                    });
+        return empty_iter == m_slots.end();
+    }
+
+private:
+    Data *get_or_update(const Key key, bool do_update)
+    {
+        auto iter =
+                std::find_if(
+                    m_slots.begin(),
+                    m_slots.end(),
+                    [key](const Slot slot)
+                    {
+                        return slot.m_key == key;
+                    });
+        if(iter != m_slots.end())
+        {
+            Slot &slot = *iter;
+            if(do_update)
+                update(slot);
+            return slot.m_data;
+        }
+        else
+        {
+            return nullptr;
+        }
+    }
+
+    void update(Slot &slot)
+    {
+        increment_time();
+        slot.m_age = 0;
+    }
+
+    void increment_time()
+    {
+        for(Slot &slot : m_slots)
+            if(slot.m_data)
+                slot.m_age++;
+    }
+};
+
+#endif /* CACHE_TEST_REFERENCE_H */
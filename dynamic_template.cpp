@@ -4,10 +4,29 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include "thread_pool.h"
+#include "utils.h"
+
+#include <boost/program_options.hpp>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <iostream>
 #include <cstdint>
 #include <vector>
 #include <memory>
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+#include <variant>
+#include <utility>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <cerrno>
+#include <system_error>
 
 using Byte = std::uint8_t;
 
@@ -38,39 +57,302 @@ public:
     }
 };
 
-template<typename Input_format, typename Output_format>
-std::vector<uint32_t> repack(
-        const std::vector<uint32_t> &input,
+template<typename Input_iterator, typename Output_iterator, typename Operation>
+Output_iterator transform_samples(
+        Input_iterator begin,
+        const Input_iterator end,
+        Output_iterator output,
+        const Operation &operation)
+{
+    for(; begin != end; ++begin, ++output)
+    {
+        *output = operation(*begin);
+    }
+    return output;
+}
+
+/* Samples are staged through a small local block, so reads of a block can not
+ * alias its writes. This lets the compiler vectorize the loops without runtime
+ * alias checks, which it skips at moderate optimization levels, and keeps in
+ * place operation valid. */
+template<typename Operation>
+std::uint32_t *transform_samples(
+        const std::uint32_t *begin,
+        const std::uint32_t *const end,
+        std::uint32_t *output,
+        const Operation &operation)
+{
+    constexpr int block_size = 16;
+    while(end - begin >= block_size)
+    {
+        std::uint32_t block[block_size];
+        for(int i = 0; i < block_size; ++i)
+            block[i] = begin[i];
+        for(int i = 0; i < block_size; ++i)
+            output[i] = operation(block[i]);
+        begin += block_size;
+        output += block_size;
+    }
+    for(; begin != end; ++begin, ++output)
+    {
+        *output = operation(*begin);
+    }
+    return output;
+}
+
+/* Core kernel. Writes one output sample per input sample through the output
+ * iterator and returns the iterator past the last written sample, so it can
+ * target a caller-supplied buffer, a back_inserter or the input itself. */
+template<
+        typename Input_iterator,
+        typename Output_iterator,
+        typename Input_format,
+        typename Output_format>
+Output_iterator repack(
+        const Input_iterator begin,
+        const Input_iterator end,
+        const Output_iterator output,
         const Input_format &input_format,
         const Output_format &output_format)
 {
-    const int size = input.size();
-    std::vector<uint32_t> output(size);
     const int shift = output_format.get_width() - input_format.get_width();
     if(shift > 0)
     {
         const int abs_shift = std::abs(shift);
-        for(int i = 0; i < size; ++i)
-        {
-            output[i] = input[i] << abs_shift;
-        }
+        return transform_samples(
+                begin,
+                end,
+                output,
+                [abs_shift](const std::uint32_t sample)
+                {
+                    return sample << abs_shift;
+                });
     }
     else if(shift < 0)
     {
         const int abs_shift = std::abs(shift);
-        for(int i = 0; i < size; ++i)
-        {
-            output[i] = input[i] >> abs_shift;
-        }
+        return transform_samples(
+                begin,
+                end,
+                output,
+                [abs_shift](const std::uint32_t sample)
+                {
+                    return sample >> abs_shift;
+                });
     }
     else
     {
-        for(int i = 0; i < size; ++i)
+        return transform_samples(
+                begin,
+                end,
+                output,
+                [](const std::uint32_t sample)
+                {
+                    return sample;
+                });
+    }
+}
+
+template<typename Input_format, typename Output_format>
+std::vector<uint32_t> repack(
+        const std::vector<uint32_t> &input,
+        const Input_format &input_format,
+        const Output_format &output_format)
+{
+    std::vector<uint32_t> output(input.size());
+    repack(
+            input.begin(),
+            input.end(),
+            output.begin(),
+            input_format,
+            output_format);
+    return output;
+}
+
+/* Input and output samples have the same size, so the conversion can always
+ * be done in place. */
+template<typename Iterator, typename Input_format, typename Output_format>
+void repack_in_place(
+        const Iterator begin,
+        const Iterator end,
+        const Input_format &input_format,
+        const Output_format &output_format)
+{
+    repack(begin, end, begin, input_format, output_format);
+}
+
+/* Repacks unbounded input in chunks of fixed size. The same buffer is reused
+ * for every chunk, so no allocation happens after construction. Each repacked
+ * chunk is handed to the sink as a [begin, end) pair of pointers, valid only
+ * until the sink returns. */
+template<typename TInput_format, typename TOutput_format>
+class Repack_stream
+{
+public:
+    using Input_format = TInput_format;
+    using Output_format = TOutput_format;
+
+private:
+    Input_format m_input_format;
+    Output_format m_output_format;
+    std::vector<uint32_t> m_buffer;
+
+public:
+    Repack_stream(
+            const std::size_t chunk_size,
+            const Input_format &input_format,
+            const Output_format &output_format) :
+        m_input_format(input_format),
+        m_output_format(output_format),
+        m_buffer(chunk_size)
+    {
+        if(chunk_size == 0)
+            throw std::runtime_error("chunk size must be positive");
+    }
+
+    template<typename Sink>
+    void write(const uint32_t *begin, const uint32_t *const end, Sink &&sink)
+    {
+        while(begin != end)
         {
-            output[i] = input[i];
+            const std::size_t count =
+                    std::min<std::size_t>(end - begin, m_buffer.size());
+            uint32_t *const output_end =
+                    repack(
+                        begin,
+                        begin + count,
+                        m_buffer.data(),
+                        m_input_format,
+                        m_output_format);
+            sink(
+                    static_cast<const uint32_t *>(m_buffer.data()),
+                    static_cast<const uint32_t *>(output_end));
+            begin += count;
         }
     }
-    return output;
+};
+
+/* Widths of Mutable_format which can be mapped onto Fixed_format. */
+constexpr int max_specialized_width = 32;
+
+template<int width, typename Result, typename Function>
+Result call_with_fixed_format(Function &function)
+{
+    return function(Fixed_format<width>());
+}
+
+template<typename Function, int... width_indexes>
+decltype(auto) specialize_width(
+        const int width,
+        Function &function,
+        std::integer_sequence<int, width_indexes...>)
+{
+    using Result = decltype(function(Fixed_format<1>()));
+    static constexpr Result (*const table[])(Function &) = {
+        &call_with_fixed_format<width_indexes + 1, Result, Function>...};
+    return table[width - 1](function);
+}
+
+/* Calls function with Fixed_format of the same width as the given format.
+ * All widths from 1 to max_specialized_width are instantiated up front and
+ * the runtime width only selects an entry of the table, so the function body
+ * sees the width as a compile time constant. */
+template<typename Function>
+decltype(auto) specialize_width(
+        const Mutable_format &format,
+        Function &&function)
+{
+    const int width = format.get_width();
+    if(width < 1 || width > max_specialized_width)
+        throw std::runtime_error("format width can not be specialized");
+    return specialize_width(
+            width,
+            function,
+            std::make_integer_sequence<int, max_specialized_width>());
+}
+
+template<int width, typename Function>
+decltype(auto) specialize_width(
+        const Fixed_format<width> &format,
+        Function &&function)
+{
+    return function(format);
+}
+
+template<typename Input_format, typename Output_format>
+std::uint32_t *repack_specialized(
+        const std::uint32_t *const begin,
+        const std::uint32_t *const end,
+        std::uint32_t *const output,
+        const Input_format &input_format,
+        const Output_format &output_format)
+{
+    return specialize_width(
+            input_format,
+            [&](const auto &fixed_input_format)
+            {
+                return specialize_width(
+                        output_format,
+                        [&](const auto &fixed_output_format)
+                        {
+                            return repack(
+                                    begin,
+                                    end,
+                                    output,
+                                    fixed_input_format,
+                                    fixed_output_format);
+                        });
+            });
+}
+
+/* Below this many samples repack_parallel stays on the calling thread. */
+constexpr std::ptrdiff_t parallel_repack_threshold = 1 << 18;
+
+/* Chunk boundaries are multiples of this many samples. Every sample occupies
+ * its own output word, so no output straddles a boundary, and aligning to
+ * 64 byte cache lines keeps threads from sharing output lines. */
+constexpr std::ptrdiff_t parallel_repack_alignment = 16;
+
+/* Splits the input into chunks processed by the pool, each writing directly to
+ * its part of the shared output. */
+template<typename Input_format, typename Output_format>
+std::uint32_t *repack_parallel(
+        Thread_pool &pool,
+        const std::uint32_t *const begin,
+        const std::uint32_t *const end,
+        std::uint32_t *const output,
+        const Input_format &input_format,
+        const Output_format &output_format)
+{
+    const std::ptrdiff_t size = end - begin;
+    const int thread_count = pool.get_thread_count();
+    if(size < parallel_repack_threshold || thread_count < 2)
+        return repack(begin, end, output, input_format, output_format);
+
+    /* few chunks per thread to even out the load */
+    const int chunk_count = 4 * thread_count;
+    const std::ptrdiff_t chunk_size =
+            (size / chunk_count + parallel_repack_alignment - 1)
+            / parallel_repack_alignment
+            * parallel_repack_alignment;
+    pool.run(
+            chunk_count,
+            [&](const int chunk)
+            {
+                const std::ptrdiff_t chunk_begin =
+                        std::min(chunk * chunk_size, size);
+                const std::ptrdiff_t chunk_end =
+                        chunk + 1 == chunk_count
+                        ? size
+                        : std::min(chunk_begin + chunk_size, size);
+                repack(
+                        begin + chunk_begin,
+                        begin + chunk_end,
+                        output + chunk_begin,
+                        input_format,
+                        output_format);
+            });
+    return output + size;
 }
 
 class Format_visitor
@@ -175,22 +457,27 @@ private:
     public:
         using Input_format = TInput_format;
     private:
-        const Input &m_input;
+        const std::uint32_t *m_begin;
+        const std::uint32_t *m_end;
+        std::uint32_t *m_output;
         const Input_format &m_input_format;
-        Output m_output;
 
     public:
         Output_selection(
-                const Input &input,
+                const std::uint32_t *const begin,
+                const std::uint32_t *const end,
+                std::uint32_t *const output,
                 const Input_format &input_format) :
-            m_input(input),
+            m_begin(begin),
+            m_end(end),
+            m_output(output),
             m_input_format(input_format)
         { }
 
         template<typename Output_format>
         void common_visit(const Output_format &output_format)
         {
-            m_output = repack(m_input, m_input_format, output_format);
+            repack(m_begin, m_end, m_output, m_input_format, output_format);
         }
 
         void visit(const Fixed_format<3> &input_format) override
@@ -207,25 +494,25 @@ private:
         {
             common_visit(input_format);
         }
-
-        Output &&get_output()
-        {
-            return std::move(m_output);
-        }
     };
 
     class Input_selection : public Format::Visitor
     {
     private:
-        const Input &m_input;
+        const std::uint32_t *m_begin;
+        const std::uint32_t *m_end;
+        std::uint32_t *m_output;
         const Format &m_output_format;
-        Output m_output;
 
     public:
         Input_selection(
-                const Input &input,
+                const std::uint32_t *const begin,
+                const std::uint32_t *const end,
+                std::uint32_t *const output,
                 const Format &output_format) :
-            m_input(input),
+            m_begin(begin),
+            m_end(end),
+            m_output(output),
             m_output_format(output_format)
         { }
 
@@ -233,10 +520,11 @@ private:
         void common_visit(const Input_format &input_format)
         {
             Output_selection<Input_format> output_selection(
-                        m_input,
+                        m_begin,
+                        m_end,
+                        m_output,
                         input_format);
             m_output_format.accept(output_selection);
-            m_output = output_selection.get_output();
         }
 
         void visit(const Fixed_format<3> &input_format) override
@@ -253,22 +541,35 @@ private:
         {
             common_visit(input_format);
         }
-
-        Output &&get_output()
-        {
-            return std::move(m_output);
-        }
     };
 
 public:
+    /* Writes end - begin samples to output. The output may alias the input,
+     * but must not overlap it partially. */
+    void operator()(
+            const std::uint32_t *const begin,
+            const std::uint32_t *const end,
+            std::uint32_t *const output,
+            const Format &input_format,
+            const Format &output_format)
+    {
+        Input_selection input_selection(begin, end, output, output_format);
+        input_format.accept(input_selection);
+    }
+
     Output operator()(
             const Input &input,
             const Format &input_format,
             const Format &output_format)
     {
-        Input_selection input_selection(input, output_format);
-        input_format.accept(input_selection);
-        return input_selection.get_output();
+        Output output(input.size());
+        (*this)(
+                input.data(),
+                input.data() + input.size(),
+                output.data(),
+                input_format,
+                output_format);
+        return output;
     }
 };
 
@@ -281,15 +582,295 @@ std::vector<std::uint32_t> repack_adapter(
     return proxy(input, input_format, output_format);
 }
 
-void print(const std::vector<uint32_t> &input)
+void repack_adapter(
+        const std::uint32_t *const begin,
+        const std::uint32_t *const end,
+        std::uint32_t *const output,
+        const Format &input_format,
+        const Format &output_format)
 {
-    for(const uint32_t i : input)
+    Repack_proxy proxy;
+    proxy(begin, end, output, input_format, output_format);
+}
+
+/* Alternative to Format without the double virtual dispatch. The formats are
+ * stored inline in the variant, so copies are trivial and no allocation takes
+ * place. std::visit over two variants resolves the (input, output) pair with a
+ * single lookup in a table of repack instantiations generated at compile
+ * time. */
+using Variant_format =
+        std::variant<Fixed_format<3>, Fixed_format<4>, Mutable_format>;
+
+void repack_variant(
+        const std::uint32_t *const begin,
+        const std::uint32_t *const end,
+        std::uint32_t *const output,
+        const Variant_format &input_format,
+        const Variant_format &output_format)
+{
+    std::visit(
+            [begin, end, output](
+                    const auto &input_format,
+                    const auto &output_format)
+            {
+                repack(begin, end, output, input_format, output_format);
+            },
+            input_format,
+            output_format);
+}
+
+std::vector<std::uint32_t> repack_variant(
+        const std::vector<uint32_t> &input,
+        const Variant_format &input_format,
+        const Variant_format &output_format)
+{
+    std::vector<std::uint32_t> output(input.size());
+    repack_variant(
+            input.data(),
+            input.data() + input.size(),
+            output.data(),
+            input_format,
+            output_format);
+    return output;
+}
+
+int get_width(const Variant_format &format)
+{
+    return std::visit(
+            [](const auto &format) { return format.get_width(); },
+            format);
+}
+
+/* Compares per call cost of both dispatch paths. The buffer is tiny, so the
+ * time is dominated by the dispatch itself. */
+void benchmark_dispatch()
+{
+    const int iterations = 10000000;
+    const std::vector<uint32_t> input{0x1, 0x2, 0x4, 0x8};
+    std::vector<uint32_t> output(input.size());
+    std::uint32_t checksum = 0;
+
     {
-        std::cout << i << ' ';
+        const Format input_format = Fixed_format<4>();
+        const Format output_format = Mutable_format(6);
+        Timer timer("visitor dispatch");
+        for(int i = 0; i < iterations; ++i)
+        {
+            repack_adapter(
+                    input.data(),
+                    input.data() + input.size(),
+                    output.data(),
+                    input_format,
+                    output_format);
+            checksum += output[i % output.size()];
+        }
     }
-    std::cout << '\n';
+
+    {
+        const Variant_format input_format = Fixed_format<4>();
+        const Variant_format output_format = Mutable_format(6);
+        Timer timer("variant dispatch");
+        for(int i = 0; i < iterations; ++i)
+        {
+            repack_variant(
+                    input.data(),
+                    input.data() + input.size(),
+                    output.data(),
+                    input_format,
+                    output_format);
+            checksum += output[i % output.size()];
+        }
+    }
+
+    std::cerr
+            << "dispatch benchmark: " << iterations << " calls per path, "
+            << "checksum " << checksum << '\n';
 }
 
+/* Compares repack with widths known only at runtime against the same
+ * conversion run through specialized kernels. Large buffers show the memory
+ * bound case, cache resident ones the cost of the kernel itself. */
+void benchmark_width_specialization(const int size, const int repetitions)
+{
+    const Mutable_format input_format(12);
+    const Mutable_format output_format(16);
+    std::vector<uint32_t> input(size);
+    for(int i = 0; i < size; ++i)
+        input[i] = i & 0xfff;
+    std::vector<uint32_t> output_runtime(size);
+    std::vector<uint32_t> output_specialized(size);
+
+    {
+        Timer timer("runtime width repack");
+        for(int i = 0; i < repetitions; ++i)
+        {
+            repack(
+                    input.data(),
+                    input.data() + size,
+                    output_runtime.data(),
+                    input_format,
+                    output_format);
+        }
+    }
+
+    {
+        Timer timer("specialized width repack");
+        for(int i = 0; i < repetitions; ++i)
+        {
+            repack_specialized(
+                    input.data(),
+                    input.data() + size,
+                    output_specialized.data(),
+                    input_format,
+                    output_format);
+        }
+    }
+
+    std::cerr
+            << "width specialization benchmark: " << repetitions << " x "
+            << size << " samples, results "
+            << (output_runtime == output_specialized ? "match" : "differ")
+            << '\n';
+}
+
+/* Repacks the same large buffer with growing number of threads. */
+void benchmark_parallel_repack()
+{
+    const int size = 1 << 25;
+    const int repetitions = 4;
+    const int max_thread_count =
+            std::max<int>(std::thread::hardware_concurrency(), 1);
+    const Fixed_format<12> input_format;
+    const Fixed_format<16> output_format;
+    std::vector<uint32_t> input(size);
+    for(int i = 0; i < size; ++i)
+        input[i] = i & 0xfff;
+    std::vector<uint32_t> reference(size);
+    repack(
+            input.data(),
+            input.data() + size,
+            reference.data(),
+            input_format,
+            output_format);
+    std::vector<uint32_t> output(size);
+
+    for(int thread_count = 1;; thread_count *= 2)
+    {
+        thread_count = std::min(thread_count, max_thread_count);
+        Thread_pool pool(thread_count);
+        {
+            Timer timer(
+                    "parallel repack, "
+                    + std::to_string(thread_count)
+                    + " threads");
+            for(int i = 0; i < repetitions; ++i)
+            {
+                repack_parallel(
+                        pool,
+                        input.data(),
+                        input.data() + size,
+                        output.data(),
+                        input_format,
+                        output_format);
+            }
+        }
+        if(output != reference)
+            std::cerr << "parallel repack result differs!\n";
+        if(thread_count == max_thread_count)
+            break;
+    }
+}
+
+/* Owns a file descriptor, closes it on destruction. */
+class File_descriptor
+{
+private:
+    int m_descriptor;
+
+public:
+    File_descriptor(
+            const std::string &path,
+            const int flags,
+            const int mode = 0) :
+        m_descriptor(::open(path.c_str(), flags, mode))
+    {
+        if(m_descriptor < 0)
+            throw std::system_error(
+                    errno,
+                    std::generic_category(),
+                    "failed to open " + path);
+    }
+
+    File_descriptor(const File_descriptor &) = delete;
+
+    File_descriptor &operator=(const File_descriptor &) = delete;
+
+    ~File_descriptor()
+    {
+        ::close(m_descriptor);
+    }
+
+    int get() const
+    {
+        return m_descriptor;
+    }
+};
+
+/* Owns a memory mapping of the whole file, unmaps it on destruction. Empty
+ * files can not be mapped, so for these the mapping stays null. */
+class Mapping
+{
+private:
+    void *m_address = nullptr;
+    std::size_t m_size;
+
+public:
+    Mapping(
+            const File_descriptor &file,
+            const std::size_t size,
+            const int protection) :
+        m_size(size)
+    {
+        if(m_size == 0)
+            return;
+        m_address =
+                ::mmap(nullptr, m_size, protection, MAP_SHARED, file.get(), 0);
+        if(m_address == MAP_FAILED)
+        {
+            m_address = nullptr;
+            throw std::system_error(
+                    errno,
+                    std::generic_category(),
+                    "failed to map file");
+        }
+        ::madvise(m_address, m_size, MADV_SEQUENTIAL);
+    }
+
+    Mapping(const Mapping &) = delete;
+
+    Mapping &operator=(const Mapping &) = delete;
+
+    ~Mapping()
+    {
+        if(m_address)
+            ::munmap(m_address, m_size);
+    }
+
+    void *get() const
+    {
+        return m_address;
+    }
+
+    void sync() const
+    {
+        if(m_address && ::msync(m_address, m_size, MS_SYNC) != 0)
+            throw std::system_error(
+                    errno,
+                    std::generic_category(),
+                    "failed to sync mapping");
+    }
+};
+
 class Get_width : private Format::Visitor
 {
 private:
@@ -319,7 +900,135 @@ public:
     }
 };
 
-int main()
+Format make_format(const int width)
+{
+    switch(width)
+    {
+    case 3:
+        return Fixed_format<3>();
+    case 4:
+        return Fixed_format<4>();
+    default:
+        if(width < 1 || width > max_specialized_width)
+            throw std::runtime_error(
+                    "sample width must be in range 1 to "
+                    + std::to_string(max_specialized_width));
+        return Mutable_format(width);
+    }
+}
+
+/* Samples converted per thread at a time, so the input of a block is still in
+ * cache when its output is written. */
+constexpr std::size_t conversion_block_size = 1 << 16;
+
+/* Converts a file of native endian 32 bit samples. Both files are memory
+ * mapped and the samples are repacked block by block, straight from the input
+ * mapping into the output mapping. The formats are taken by their widths into
+ * repack_specialized's table, so every width runs with compile time shifts,
+ * and each block is split among threads. When both paths name the same file,
+ * it is converted in place, as samples keep their size. */
+void convert_file(
+        const std::string &input_path,
+        const std::string &output_path,
+        const Format &input_format,
+        const Format &output_format)
+{
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point start = Clock::now();
+
+    const auto get_stat = [](
+            const File_descriptor &file,
+            const std::string &path)
+    {
+        struct stat result;
+        if(::fstat(file.get(), &result) != 0)
+            throw std::system_error(
+                    errno,
+                    std::generic_category(),
+                    "failed to stat " + path);
+        return result;
+    };
+
+    const File_descriptor input_file(input_path, O_RDONLY);
+    const struct stat input_stat = get_stat(input_file, input_path);
+    const std::size_t size = input_stat.st_size;
+    if(size % sizeof(std::uint32_t) != 0)
+        throw std::runtime_error("input size is not a multiple of sample size");
+
+    /* not truncated on open, the output may be the input */
+    const File_descriptor output_file(output_path, O_RDWR | O_CREAT, 0644);
+    const struct stat output_stat = get_stat(output_file, output_path);
+    const bool in_place =
+            output_stat.st_dev == input_stat.st_dev
+            && output_stat.st_ino == input_stat.st_ino;
+    if(!in_place && ::ftruncate(output_file.get(), size) != 0)
+        throw std::system_error(
+                errno,
+                std::generic_category(),
+                "failed to resize " + output_path);
+
+    const Mapping output_mapping(output_file, size, PROT_READ | PROT_WRITE);
+    std::uint32_t *const output =
+            static_cast<std::uint32_t *>(output_mapping.get());
+    std::unique_ptr<Mapping> input_mapping;
+    const std::uint32_t *input = output;
+    if(!in_place)
+    {
+        input_mapping = std::make_unique<Mapping>(input_file, size, PROT_READ);
+        input = static_cast<const std::uint32_t *>(input_mapping->get());
+    }
+
+    const std::size_t sample_count = size / sizeof(std::uint32_t);
+    Thread_pool pool(std::max<int>(std::thread::hardware_concurrency(), 1));
+    /* big enough for repack_parallel to split it */
+    const std::size_t block_size = std::max<std::size_t>(
+            conversion_block_size * pool.get_thread_count(),
+            parallel_repack_threshold);
+    Get_width get_width;
+    specialize_width(
+            Mutable_format(get_width(input_format)),
+            [&](const auto &fixed_input_format)
+            {
+                specialize_width(
+                        Mutable_format(get_width(output_format)),
+                        [&](const auto &fixed_output_format)
+                        {
+                            for(
+                                    std::size_t i = 0;
+                                    i < sample_count;
+                                    i += block_size)
+                            {
+                                const std::size_t count =
+                                        std::min(block_size, sample_count - i);
+                                repack_parallel(
+                                        pool,
+                                        input + i,
+                                        input + i + count,
+                                        output + i,
+                                        fixed_input_format,
+                                        fixed_output_format);
+                            }
+                        });
+            });
+    output_mapping.sync();
+
+    const std::chrono::duration<double> elapsed = Clock::now() - start;
+    const double megabytes = size / 1e6;
+    std::cerr
+            << "converted " << megabytes << " MB in " << elapsed.count()
+            << " s, " << megabytes / elapsed.count() << " MB/s\n";
+}
+
+void print(const std::vector<uint32_t> &input)
+{
+    for(const uint32_t i : input)
+    {
+        std::cout << i << ' ';
+    }
+    std::cout << '\n';
+}
+
+void demo()
 {
     const std::vector<uint32_t> test_data{0x1, 0x2, 0x4, 0x8};
     std::cout << "test_data:\n";
@@ -341,6 +1050,65 @@ int main()
     std::cout << "test_output2:\n";
     print(test_output2);
 
+    std::vector<uint32_t> test_output3(test_data.size());
+    repack_adapter(
+            test_data.data(),
+            test_data.data() + test_data.size(),
+            test_output3.data(),
+            input_format,
+            output_format);
+    std::cout << "test_output3:\n";
+    print(test_output3);
+
+    std::vector<uint32_t> in_place_data = test_data;
+    repack_in_place(
+            in_place_data.begin(),
+            in_place_data.end(),
+            Fixed_format<4>(),
+            Mutable_format(6));
+    std::cout << "in_place_data:\n";
+    print(in_place_data);
+
+    std::vector<uint32_t> specialized_output(test_data.size());
+    repack_specialized(
+            test_data.data(),
+            test_data.data() + test_data.size(),
+            specialized_output.data(),
+            Mutable_format(4),
+            Mutable_format(6));
+    std::cout << "specialized_output:\n";
+    print(specialized_output);
+
+    std::vector<uint32_t> streamed_output;
+    Repack_stream<Fixed_format<4>, Mutable_format> stream(
+            3,
+            Fixed_format<4>(),
+            Mutable_format(6));
+    stream.write(
+            test_data.data(),
+            test_data.data() + test_data.size(),
+            [&streamed_output](const uint32_t *begin, const uint32_t *end)
+            {
+                streamed_output.insert(streamed_output.end(), begin, end);
+            });
+    std::cout << "streamed_output:\n";
+    print(streamed_output);
+
+    const Variant_format variant_input_format = Fixed_format<4>();
+    const Variant_format variant_output_format = Mutable_format(6);
+    const std::vector<uint32_t> test_output4 =
+            repack_variant(
+                test_data,
+                variant_input_format,
+                variant_output_format);
+    std::cout << "test_output4:\n";
+    print(test_output4);
+    std::cout
+            << "variant input width = " << get_width(variant_input_format)
+            << '\n'
+            << "variant output width = " << get_width(variant_output_format)
+            << '\n';
+
     Format format_copy = output_format;
     Get_width get_width;
     std::cout
@@ -360,6 +1128,69 @@ int main()
     {
         std::cout << "Detected attempt of undefined behaviour.\n";
     }
+}
+
+void benchmark()
+{
+    benchmark_dispatch();
+    benchmark_width_specialization(1 << 24, 10);
+    benchmark_width_specialization(1 << 12, 40000);
+    benchmark_parallel_repack();
+}
+
+namespace po = boost::program_options;
+
+int main(const int argc, const char *const argv[]) try
+{
+    po::options_description description(
+            "Converts a file of 32 bit samples between sample widths.\n"
+            "Without options runs a demonstration.\n"
+            "Allowed options");
+    description.add_options()
+            ("help", "show help")
+            ("benchmark", "run the benchmarks")
+            ("input", po::value<std::string>(), "input file")
+            ("output", po::value<std::string>(), "output file")
+            ("input-width", po::value<int>(), "input sample width in bits")
+            ("output-width", po::value<int>(), "output sample width in bits");
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, description), vm);
+    po::notify(vm);
+
+    if(vm.count("help"))
+    {
+        std::cout << description << '\n';
+    }
+    else if(vm.count("benchmark"))
+    {
+        benchmark();
+    }
+    else if(vm.count("input") || vm.count("output"))
+    {
+        if(!vm.count("input")
+                || !vm.count("output")
+                || !vm.count("input-width")
+                || !vm.count("output-width"))
+        {
+            std::cout << description << '\n';
+            throw std::runtime_error("invalid commandline");
+        }
+        convert_file(
+                vm["input"].as<std::string>(),
+                vm["output"].as<std::string>(),
+                make_format(vm["input-width"].as<int>()),
+                make_format(vm["output-width"].as<int>()));
+    }
+    else
+    {
+        demo();
+    }
 
     return 0;
 }
+catch(std::exception &e)
+{
+    std::cerr << "std::exception caught: " << e.what() << '\n';
+    return -1;
+}
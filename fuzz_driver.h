@@ -0,0 +1,123 @@
+/*
+ * SPDX-FileCopyrightText: 2016 Dominik Wójt <domin144@o2.pl>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef FUZZ_DRIVER_H
+#define FUZZ_DRIVER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+/* Defined by every harness, in the form libFuzzer expects. A failed check
+ * throws. */
+extern "C" int LLVMFuzzerTestOneInput(
+        const std::uint8_t *data,
+        std::size_t size);
+
+/*----------------------------------------------------------------------------*/
+/* Fuzz_input class.
+ *
+ * Bytes of a fuzzer input, read one by one as operations and their
+ * arguments. Past the end it gives zeros, so any input is valid. */
+/*----------------------------------------------------------------------------*/
+class Fuzz_input
+{
+    const std::uint8_t *m_data;
+    std::size_t m_size;
+    std::size_t m_position;
+public:
+    Fuzz_input(const std::uint8_t *const data, const std::size_t size) :
+        m_data(data),
+        m_size(size),
+        m_position(0)
+    {
+    }
+
+    bool empty() const
+    {
+        return m_position >= m_size;
+    }
+
+    std::uint8_t next()
+    {
+        return empty() ? 0 : m_data[m_position++];
+    }
+};
+
+#ifndef LIBFUZZER
+/* Without libFuzzer the harness replays the given files, like crash inputs
+ * found by libFuzzer, or runs random inputs. A failing random input is saved,
+ * so it can be replayed. */
+int main(const int argc, const char *const argv[])
+{
+    const auto run = [](const std::vector<std::uint8_t> &input)
+    {
+        try
+        {
+            LLVMFuzzerTestOneInput(input.data(), input.size());
+            return true;
+        }
+        catch(std::exception &e)
+        {
+            std::cerr << "check failed: " << e.what() << '\n';
+            return false;
+        }
+    };
+
+    if(argc > 1)
+    {
+        for(int i = 1; i < argc; ++i)
+        {
+            std::ifstream file(argv[i], std::ios::binary);
+            if(!file)
+            {
+                std::cerr << "failed to open " << argv[i] << '\n';
+                return -1;
+            }
+            const std::vector<std::uint8_t> input(
+                    (std::istreambuf_iterator<char>(file)),
+                    std::istreambuf_iterator<char>());
+            if(!run(input))
+            {
+                std::cerr << "failed on " << argv[i] << '\n';
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    const int run_count = 25000;
+    const std::size_t max_size = 2048;
+    std::mt19937 gen(0);
+    std::uniform_int_distribution<std::size_t> size_distribution(0, max_size);
+    std::uniform_int_distribution<int> byte_distribution(0, 255);
+    std::vector<std::uint8_t> input;
+    for(int i = 0; i < run_count; ++i)
+    {
+        input.resize(size_distribution(gen));
+        for(std::uint8_t &byte : input)
+            byte = byte_distribution(gen);
+        if(!run(input))
+        {
+            const std::string name = "crash-" + std::to_string(i);
+            std::ofstream(name, std::ios::binary).write(
+                    reinterpret_cast<const char *>(input.data()),
+                    input.size());
+            std::cerr << "failing input saved to " << name << '\n';
+            return -1;
+        }
+    }
+    return 0;
+}
+#endif
+
+#endif /* FUZZ_DRIVER_H */
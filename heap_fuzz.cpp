@@ -0,0 +1,66 @@
+/*
+ * SPDX-FileCopyrightText: 2016 Dominik Wójt <domin144@o2.pl>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "fuzz_driver.h"
+#include "trees_and_heaps.h"
+
+#include <algorithm>
+#include <functional>
+#include <set>
+#include <vector>
+
+/* Runs pushes and pops on Heap, checked against a multiset, then sorts
+ * the whole input with my_make_heap and my_sort_heap, checked against
+ * std::sort. */
+template<typename Compare>
+void check_heap(Fuzz_input input, const std::vector<int> &values)
+{
+    Heap<int, Compare> heap;
+    std::multiset<int, Compare> reference;
+    while(!input.empty())
+    {
+        const int value = input.next();
+        if(value % 2 == 0 || reference.empty())
+        {
+            heap.push(value);
+            reference.insert(value);
+        }
+        else
+        {
+            /* the top of the heap is the last in the order of Compare */
+            const auto top = std::prev(reference.end());
+            my_assert(heap.pop() == *top, "pop of a wrong value");
+            reference.erase(top);
+        }
+        my_assert(
+                heap.get_size() == static_cast<Index>(reference.size()),
+                "wrong heap size");
+    }
+
+    std::vector<int> sorted = values;
+    std::vector<int> reference_sorted = values;
+    my_make_heap(sorted.begin(), sorted.end(), Compare());
+    my_sort_heap(sorted.begin(), sorted.end(), Compare());
+    std::sort(reference_sorted.begin(), reference_sorted.end(), Compare());
+    my_assert(sorted == reference_sorted, "heap sort of a wrong order");
+}
+
+/* The first byte chooses the order, every next one is a value to push, when
+ * even, or a pop, when odd. */
+extern "C" int LLVMFuzzerTestOneInput(
+        const std::uint8_t *const data,
+        const std::size_t size)
+{
+    if(size == 0)
+        return 0;
+    const std::vector<int> values(data + 1, data + size);
+    const Fuzz_input input(data + 1, size - 1);
+    if(data[0] % 2 == 0)
+        check_heap<std::less<int>>(input, values);
+    else
+        check_heap<std::greater<int>>(input, values);
+    return 0;
+}
@@ -17,25 +17,58 @@ Modifications to the original are:
 - language changed to C++. I don't know Ruby ;))
 
 Usage:
-    hp_4510s_fan_control CONFIG_FILE
+    hp_4510s_fan_control [--console] CONFIG_FILE
+    hp_4510s_fan_control --simulate SECONDS CONFIG_FILE...
+    hp_4510s_fan_control --replay TRACE_FILE CONFIG_FILE...
+
+--console
+    read temperatures from the standard input and print the speed levels,
+    instead of using the sysfs files; a line is a temperature, or the time
+    in seconds and the temperature, without times the temperature is not
+    predicted from its slope
+--simulate
+    run every config for SECONDS of virtual time against a thermal model of
+    the laptop and print the peak temperature, the number of speed level
+    switches and the energy used by the fans
+--replay
+    like --simulate, but on temperatures recorded in TRACE_FILE, as lines of
+    time in seconds and temperature
 
 CONFIG_FILE
     config file should contain 10 numbers separated with any whitespace.
     The numbers are T1_on, T1_off, T2_on, T2_off..., T5_off, T5_on
     T?_off is temperature at which given speed level is lowered,
     T?_on is temperature at which given speed level is increased
+    They may be followed by a word "pid" and 6 numbers:
+    T_target, K_p, K_i, K_d, dwell and deadband, to choose the speed level with
+    a PID loop instead. K_p, K_i and K_d are gains of levels per degree,
+    degree second and degree per second. Lower levels are taken only after
+    dwell seconds from the previous switch. The output has to be deadband
+    levels past the rounding boundary to switch.
+    The daemon reloads the config file when it changes.
 )";
 
+#include "hp_4510s_fan_control_controller.h"
+#include "hp_4510s_fan_control_simulation.h"
+
 #include <vector>
-#include <numeric>
 #include <stdexcept>
 #include <iostream>
-#include <fstream>
+#include <sstream>
 #include <thread>
+#include <chrono>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
 
-const int history_lenght = 5;
-const std::chrono::milliseconds update_period(1000);
-const int speed_levels_count = 6; /* i.e. 0..5 */
+const std::chrono::milliseconds restart_delay(1000);
 const char *cooling_devices[] =
 {
     "/sys/devices/virtual/thermal/cooling_device0/cur_state",
@@ -51,181 +84,537 @@ const char *monitor_devices[] =
     "/sys/class/hwmon/hwmon0/temp4_input",
 };
 
-template<typename TValue>
-class History
+/* Used when the driver provides them, sysfs notifies their changes. */
+const char *alarm_devices[] =
 {
+    "/sys/class/hwmon/hwmon0/temp3_max_alarm",
+    "/sys/class/hwmon/hwmon0/temp3_crit_alarm",
+    "/sys/class/hwmon/hwmon0/temp4_max_alarm",
+    "/sys/class/hwmon/hwmon0/temp4_crit_alarm",
+};
+
+/* Parses a decimal integer, as printed by sysfs. Whatever follows the digits,
+ * like the newline, is ignored. */
+long parse_integer(const char *begin, const char *const end)
+{
+    const bool negative = begin != end && *begin == '-';
+    if(negative)
+        ++begin;
+    if(begin == end || *begin < '0' || *begin > '9')
+        throw std::runtime_error("failed to parse sysfs value");
+    long result = 0;
+    for(; begin != end && *begin >= '0' && *begin <= '9'; ++begin)
+        result = result * 10 + (*begin - '0');
+    return negative ? -result : result;
+}
+
+/* sysfs attribute opened once. sysfs regenerates the value on every read at
+ * offset 0, so the descriptor is reused instead of reopening the file every
+ * tick. */
+class Sysfs_file
+{
+    const char *m_path;
+    int m_descriptor;
 public:
-    using Value = TValue;
-private:
-    std::vector<Value> m_buffer;
-    int m_index;
-    int m_lenght;
-public:
-    History(int lenght) :
-        m_buffer(),
-        m_index(0),
-        m_lenght(lenght)
+    Sysfs_file(const char *path, const int flags) :
+        m_path(path),
+        m_descriptor(::open(path, flags | O_CLOEXEC))
     {
-        m_buffer.reserve(lenght);
+        if(m_descriptor < 0)
+            throw std::system_error(
+                    errno,
+                    std::generic_category(),
+                    std::string("failed to open ") + path);
     }
 
-    void update(Value x)
+    Sysfs_file(Sysfs_file &&other) :
+        m_path(other.m_path),
+        m_descriptor(other.m_descriptor)
     {
-        if(m_buffer.size() < m_lenght)
-            m_buffer.push_back(x);
-        else
-            m_buffer[m_index] = x;
-        m_index = (m_index + 1) % m_lenght;
+        other.m_descriptor = -1;
     }
 
-    Value average() const
+    Sysfs_file(const Sysfs_file &) = delete;
+    Sysfs_file &operator=(const Sysfs_file &) = delete;
+
+    ~Sysfs_file()
     {
-        if(m_buffer.empty())
-            return 0;
-        else
-            return
-                    std::accumulate(
-                        m_buffer.begin(),
-                        m_buffer.end(),
-                        static_cast<double>(0))
-                    / m_buffer.size();
+        if(m_descriptor >= 0)
+            ::close(m_descriptor);
+    }
+
+    int descriptor() const
+    {
+        return m_descriptor;
+    }
+
+    long read_integer() const
+    {
+        char buffer[32];
+        ssize_t size;
+        do
+        {
+            size = ::pread(m_descriptor, buffer, sizeof(buffer), 0);
+        }
+        while(size < 0 && errno == EINTR);
+        if(size < 0)
+            throw std::system_error(
+                    errno,
+                    std::generic_category(),
+                    std::string("failed to read ") + m_path);
+        return parse_integer(buffer, buffer + size);
+    }
+
+    void write_digit(const int digit) const
+    {
+        const char buffer[] = {static_cast<char>('0' + digit), '\n'};
+        ssize_t size;
+        do
+        {
+            size = ::pwrite(m_descriptor, buffer, sizeof(buffer), 0);
+        }
+        while(size < 0 && errno == EINTR);
+        if(size < 0)
+            throw std::system_error(
+                    errno,
+                    std::generic_category(),
+                    std::string("failed to write ") + m_path);
     }
 };
 
-double read_temperature()
+/* Sleeps on a one-shot timerfd, polled together with sysfs attributes which
+ * wake it up early. sysfs reports a change of an attribute as POLLPRI, after
+ * which it has to be read again to wait for the next one. */
+class Event_loop
 {
-    if(true)
+    std::vector<pollfd> m_descriptors;
+    /* of m_descriptors[1...] */
+    std::vector<const Sysfs_file *> m_notifiers;
+public:
+    Event_loop()
     {
-        double z;
-        std::cin >> z;
-        if(!std::cin.good())
-            throw std::runtime_error("failed to read input");
-        return z;
+        const int timer = ::timerfd_create(
+                CLOCK_MONOTONIC,
+                TFD_NONBLOCK | TFD_CLOEXEC);
+        if(timer < 0)
+            throw std::system_error(
+                    errno,
+                    std::generic_category(),
+                    "failed to create timer");
+        m_descriptors.push_back({timer, POLLIN, 0});
     }
-    double max = 0;
-    for(const auto monitor_device : monitor_devices)
+
+    Event_loop(const Event_loop &) = delete;
+    Event_loop &operator=(const Event_loop &) = delete;
+
+    ~Event_loop()
     {
-        std::ifstream file(monitor_device);
-        double z;
-        file >> z;
-        z /= 1000;
-        if(z > max)
-            max = z;
+        ::close(m_descriptors[0].fd);
     }
-    return max;
-}
 
-void set_speed_level(int speed_level)
-{
-    if(true)
+    /* The file has to stay open while the loop is used. */
+    void add_notifier(const Sysfs_file &file)
     {
-        std::cout << "speed level: " << speed_level << '\n';
-        return;
+        file.read_integer();
+        m_descriptors.push_back({file.descriptor(), POLLPRI, 0});
+        m_notifiers.push_back(&file);
     }
-    const int cooling_devices_count =
-            sizeof(cooling_devices) / sizeof(cooling_devices[0]);
-    for(int i = 0; i < cooling_devices_count; ++i)
+
+    /* Returns true when woken up by a notifier before the interval passed. */
+    bool wait(const std::chrono::milliseconds interval)
     {
-        std::ofstream file(cooling_devices[i]);
-        if(i < speed_level)
+        itimerspec timer_value{};
+        timer_value.it_value.tv_sec = interval.count() / 1000;
+        timer_value.it_value.tv_nsec = interval.count() % 1000 * 1000000;
+        const int timer = m_descriptors[0].fd;
+        if(::timerfd_settime(timer, 0, &timer_value, nullptr) != 0)
+            throw std::system_error(
+                    errno,
+                    std::generic_category(),
+                    "failed to set timer");
+
+        while(::poll(m_descriptors.data(), m_descriptors.size(), -1) < 0)
         {
-            file << 1;
+            if(errno != EINTR)
+                throw std::system_error(
+                        errno,
+                        std::generic_category(),
+                        "failed to poll");
         }
-        else
+
+        bool notified = false;
+        for(std::size_t i = 1; i < m_descriptors.size(); ++i)
         {
-            file << 0;
+            if(m_descriptors[i].revents & (POLLPRI | POLLERR))
+            {
+                m_notifiers[i - 1]->read_integer();
+                notified = true;
+            }
         }
+        std::uint64_t expirations;
+        if(::read(timer, &expirations, sizeof(expirations)) < 0
+                && errno != EAGAIN)
+            throw std::system_error(
+                    errno,
+                    std::generic_category(),
+                    "failed to read timer");
+        return notified;
     }
-}
+};
 
-struct Config
+/* Reports changes of a file, also when an editor replaces it with a rename, as
+ * its directory is watched. Nothing blocks on the descriptor, it is checked
+ * at every reading, so a change applies within the update period. */
+class File_watcher
 {
-    struct Level_limits
+    std::string m_name;
+    int m_descriptor;
+public:
+    File_watcher(const std::string &path) :
+        m_name(path.substr(path.find_last_of('/') + 1)),
+        m_descriptor(::inotify_init1(IN_NONBLOCK | IN_CLOEXEC))
+    {
+        if(m_descriptor < 0)
+            throw std::system_error(
+                    errno,
+                    std::generic_category(),
+                    "failed to initialize inotify");
+        const std::size_t slash = path.find_last_of('/');
+        const std::string directory = slash == std::string::npos
+                ? std::string(".")
+                : path.substr(0, slash + 1);
+        if(::inotify_add_watch(
+                m_descriptor,
+                directory.c_str(),
+                IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+        {
+            const int error = errno;
+            ::close(m_descriptor);
+            throw std::system_error(
+                    error,
+                    std::generic_category(),
+                    "failed to watch " + directory);
+        }
+    }
+
+    File_watcher(const File_watcher &) = delete;
+    File_watcher &operator=(const File_watcher &) = delete;
+
+    ~File_watcher()
     {
-        double off;
-        double on;
-    };
+        ::close(m_descriptor);
+    }
 
-    Level_limits levels[speed_levels_count];
+    bool changed()
+    {
+        bool result = false;
+        alignas(inotify_event) char buffer[4096];
+        while(true)
+        {
+            const ssize_t size = ::read(m_descriptor, buffer, sizeof(buffer));
+            if(size < 0 && errno == EINTR)
+                continue;
+            if(size < 0 && errno == EAGAIN)
+                return result;
+            if(size < 0)
+                throw std::system_error(
+                        errno,
+                        std::generic_category(),
+                        "failed to read inotify");
+            for(ssize_t offset = 0; offset < size;)
+            {
+                const inotify_event &event =
+                        *reinterpret_cast<const inotify_event *>(
+                            buffer + offset);
+                if(event.len > 0 && m_name == event.name)
+                    result = true;
+                offset += sizeof(inotify_event) + event.len;
+            }
+        }
+    }
 };
 
-[[ noreturn ]] void monitor(const Config &config)
+/* Source of the temperatures and sink of the speed level. */
+class Io
 {
-    History<double> temperature_history(history_lenght);
-    int speed_level = 0;
+public:
+    virtual ~Io() = default;
+    virtual int sensor_count() const = 0;
+    /* one for every sensor */
+    virtual void read_temperatures(std::vector<double> &temperatures) = 0;
+    virtual void set_speed_level(int speed_level) = 0;
+    /* Waits for the next reading, returns true if it should be taken right
+     * away, on an alarm. */
+    virtual bool wait(std::chrono::milliseconds interval) = 0;
+    /* time of the readings, in seconds */
+    virtual double time() const = 0;
+    /* false when the times are made up, the slope means nothing then */
+    virtual bool real_time() const = 0;
+};
 
-    while(true)
+/* Reads temperatures from the standard input and prints the speed levels, for
+ * trying out configurations. A line is a temperature or, to try out the
+ * prediction, the time in seconds and the temperature. */
+class Console_io : public Io
+{
+    double m_time = 0;
+    bool m_real_time = false;
+public:
+    int sensor_count() const override
     {
-        temperature_history.update(read_temperature());
-        const double average = temperature_history.average();
+        return 1;
+    }
 
-        while(
-                speed_level + 1 < speed_levels_count
-                && average > config.levels[speed_level + 1].on)
+    void read_temperatures(std::vector<double> &temperatures) override
+    {
+        std::string line;
+        if(!std::getline(std::cin, line))
+            throw std::runtime_error("failed to read input");
+        std::istringstream fields(line);
+        double first;
+        double second;
+        if(!(fields >> first))
+            throw std::runtime_error("failed to read input");
+        m_real_time = static_cast<bool>(fields >> second);
+        if(m_real_time)
         {
-            ++speed_level;
+            if(first < m_time)
+                throw std::runtime_error("input times have to increase");
+            m_time = first;
+            temperatures[0] = second;
         }
-        while(
-                speed_level - 1 >= 0
-                && average < config.levels[speed_level].off)
+        else
         {
-            --speed_level;
+            temperatures[0] = first;
         }
+    }
 
-        std::cout
-                << "T = " << average
-                << ", speed_level = " << speed_level << '\n';
-        set_speed_level(speed_level);
+    void set_speed_level(const int speed_level) override
+    {
+        std::cout << "speed level: " << speed_level << '\n';
+    }
 
-        std::this_thread::sleep_for(update_period);
+    /* a line without a time is taken as read after the interval */
+    bool wait(const std::chrono::milliseconds interval) override
+    {
+        m_time += interval.count() / 1000.0;
+        return false;
     }
-}
 
-Config read_config(const std::string &config_name)
+    double time() const override
+    {
+        return m_time;
+    }
+
+    bool real_time() const override
+    {
+        return m_real_time;
+    }
+};
+
+/* The hwmon sensors and cooling devices of the laptop. All files are opened
+ * up front, a tick costs one pread per sensor and, only when the speed level
+ * changes, one pwrite per changed cooling device. */
+class Sysfs_io : public Io
 {
-    std::ifstream config_file(config_name);
+    std::vector<Sysfs_file> m_monitor_files;
+    std::vector<Sysfs_file> m_cooling_files;
+    std::vector<Sysfs_file> m_alarm_files;
+    Event_loop m_event_loop;
+    /* unknown at first, so all cooling devices are written then */
+    int m_speed_level = -1;
+    const std::chrono::steady_clock::time_point m_start =
+            std::chrono::steady_clock::now();
+public:
+    Sysfs_io()
+    {
+        for(const auto monitor_device : monitor_devices)
+            m_monitor_files.emplace_back(monitor_device, O_RDONLY);
+        for(const auto cooling_device : cooling_devices)
+            m_cooling_files.emplace_back(cooling_device, O_WRONLY);
+        for(const auto alarm_device : alarm_devices)
+            if(::access(alarm_device, R_OK) == 0)
+                m_alarm_files.emplace_back(alarm_device, O_RDONLY);
+        for(const Sysfs_file &file : m_alarm_files)
+            m_event_loop.add_notifier(file);
+    }
+
+    bool wait(const std::chrono::milliseconds interval) override
+    {
+        return m_event_loop.wait(interval);
+    }
 
-    Config result;
+    double time() const override
+    {
+        const std::chrono::duration<double> result =
+                std::chrono::steady_clock::now() - m_start;
+        return result.count();
+    }
 
-    result.levels[0].off = 0;
-    result.levels[0].on = 0.1;
-    for(int i = 1; i < speed_levels_count; ++i)
+    bool real_time() const override
     {
-        config_file >> result.levels[i].off >> result.levels[i].on;
+        return true;
     }
-    if(!config_file.good())
-        throw std::runtime_error("failed to read config file");
 
-    for(int i = 1; i < speed_levels_count; ++i)
+    int sensor_count() const override
     {
-        if(result.levels[i - 1].off > result.levels[i].off)
-            throw std::runtime_error(
-                    "off temperatures are not non-decreasing with speed level");
-        if(result.levels[i - 1].on > result.levels[i].on)
-            throw std::runtime_error(
-                    "on temperatures are not non-decreasing with speed level");
+        return static_cast<int>(m_monitor_files.size());
     }
 
-    for(int i = 0; i < speed_levels_count; ++i)
-        if(result.levels[i].on <= result.levels[i].off)
-            throw std::runtime_error(
-                    "on temperature is not greater than off temperature");
+    /* all sensors are read in one pass, in millidegrees */
+    void read_temperatures(std::vector<double> &temperatures) override
+    {
+        for(std::size_t i = 0; i < m_monitor_files.size(); ++i)
+            temperatures[i] = m_monitor_files[i].read_integer() / 1000.0;
+    }
 
-    return result;
+    void set_speed_level(const int speed_level) override
+    {
+        const int cooling_devices_count =
+                static_cast<int>(m_cooling_files.size());
+        for(int i = 0; i < cooling_devices_count; ++i)
+        {
+            const bool on = i < speed_level;
+            if(m_speed_level >= 0 && on == (i < m_speed_level))
+                continue;
+            m_cooling_files[i].write_digit(on ? 1 : 0);
+        }
+        m_speed_level = speed_level;
+    }
+};
+
+/* An invalid new config is reported and the previous one is kept. */
+[[ noreturn ]] void monitor(
+        const std::string &config_name,
+        Config &config,
+        Io &io)
+{
+    File_watcher config_watcher(config_name);
+    Controller controller(config, io.sensor_count());
+    std::vector<double> temperatures(io.sensor_count());
+    int previous_speed_level = -1;
+
+    while(true)
+    {
+        if(config_watcher.changed())
+        {
+            try
+            {
+                config = read_config(config_name);
+                controller.set_config(config);
+                std::cout << "config reloaded\n";
+            }
+            catch(std::exception &e)
+            {
+                std::cerr << "config not reloaded: " << e.what() << '\n';
+            }
+        }
+
+        io.read_temperatures(temperatures);
+        controller.set_prediction(io.real_time());
+        controller.update(io.time(), temperatures);
+        const int speed_level = controller.speed_level();
+
+        if(speed_level != previous_speed_level)
+        {
+            const bool predicted = !config.pid.enabled && io.real_time();
+            std::cout
+                    << "T = " << controller.measured_temperature()
+                    << (predicted ? ", predicted T = " : ", smoothed T = ")
+                    << controller.temperature()
+                    << ", speed_level = " << speed_level << '\n';
+            previous_speed_level = speed_level;
+        }
+        io.set_speed_level(speed_level);
+
+        if(io.wait(controller.interval()))
+            controller.alarm();
+    }
+}
+
+void print_score(
+        const std::string &config_name,
+        const Simulation_score &score,
+        const double seconds)
+{
+    std::cout
+            << config_name
+            << ": peak T = " << score.peak_temperature
+            << ", T deviation = " << score.temperature_deviation
+            << ", switches = " << score.switch_count
+            << ", fan energy = " << score.fan_energy << " J, "
+            << score.tick_count << " ticks in " << seconds << " s ("
+            << score.tick_count / seconds << " ticks/s)\n";
+}
+
+/* Scores every config given after the mode and its argument. */
+void simulate_configs(const int argc, const char *const argv[])
+{
+    if(argc < 4)
+        throw std::runtime_error("invalid commandline");
+    const bool replay = std::strcmp(argv[1], "--replay") == 0;
+    const Thermal_model model;
+    std::vector<Trace_sample> trace;
+    std::chrono::milliseconds duration = std::chrono::milliseconds::max();
+    if(replay)
+        trace = read_trace(argv[2]);
+    else
+        duration = std::chrono::milliseconds(
+                static_cast<std::int64_t>(std::stod(argv[2]) * 1000));
+
+    for(int i = 3; i < argc; ++i)
+    {
+        const Config config = read_config(argv[i]);
+        const auto start = std::chrono::steady_clock::now();
+        Simulation_score score;
+        if(replay)
+        {
+            Trace_replay plant(trace);
+            score = simulate(config, model, plant, duration);
+        }
+        else
+        {
+            Thermal_simulation plant(model);
+            score = simulate(config, model, plant, duration);
+        }
+        const std::chrono::duration<double> elapsed =
+                std::chrono::steady_clock::now() - start;
+        print_score(argv[i], score, elapsed.count());
+    }
 }
 
 int main(const int argc, const char *const argv[]) try
 {
-    if(argc != 2)
+    if(argc > 1
+            && (std::strcmp(argv[1], "--simulate") == 0
+                || std::strcmp(argv[1], "--replay") == 0))
+    {
+        simulate_configs(argc, argv);
+        return 0;
+    }
+
+    const bool console = argc == 3 && std::strcmp(argv[1], "--console") == 0;
+    if(argc != 2 && !console)
         throw std::runtime_error("invalid commandline");
 
-    const Config config = read_config(argv[1]);
+    const std::string config_name = argv[argc - 1];
+    Config config = read_config(config_name);
 
     while(true)
     {
         try
         {
-            monitor(config);
+            /* reopened after an error, in case the devices changed */
+            if(console)
+            {
+                Console_io io;
+                monitor(config_name, config, io);
+            }
+            else
+            {
+                Sysfs_io io;
+                monitor(config_name, config, io);
+            }
         }
         catch(std::exception &e)
         {
@@ -239,7 +628,7 @@ int main(const int argc, const char *const argv[]) try
                     << "unknown caught\n"
                     << "restarting...\n";
         }
-        std::this_thread::sleep_for(update_period);
+        std::this_thread::sleep_for(restart_delay);
     }
 }
 catch(std::exception &e)
@@ -0,0 +1,315 @@
+/*
+ * SPDX-FileCopyrightText: 2014-2015 Rok Krajl
+ * SPDX-FileCopyrightText: 2016 Dominik Wójt <domin144@o2.pl>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef HP_4510S_FAN_CONTROL_CONTROLLER_H
+#define HP_4510S_FAN_CONTROL_CONTROLLER_H
+
+#include "hp_4510s_fan_control_statistics.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+const int speed_levels_count = 6; /* i.e. 0..5 */
+const int history_lenght = 5;
+/* The speed level follows the temperature predicted this far ahead from the
+ * slope, when it rises, and smoothed with this time constant. */
+const double prediction_horizon = 4.0; /* s */
+const double ewma_time_constant = 2.0; /* s */
+/* The interval between readings doubles while the temperature is stable and
+ * drops to the minimum when it rises fast. */
+const std::chrono::milliseconds min_update_period(250);
+const std::chrono::milliseconds max_update_period(8000);
+const double stable_temperature_change = 0.5;
+const double fast_temperature_slope = 1.0; /* per second */
+
+struct Config
+{
+    struct Level_limits
+    {
+        double off;
+        double on;
+    };
+
+    /* PID control of the speed level, used instead of the hysteresis when
+     * enabled. */
+    struct Pid
+    {
+        bool enabled = false;
+        double target_temperature;
+        double proportional_gain; /* levels per degree */
+        double integral_gain; /* levels per degree second */
+        double derivative_gain; /* levels per degree per second */
+        /* before a lower level is taken, in s */
+        double min_dwell;
+        /* how far past the rounding boundary the output has to be to change
+         * the level, so it doesn't dither between two levels */
+        double level_deadband;
+    };
+
+    Level_limits levels[speed_levels_count];
+    Pid pid;
+};
+
+inline Config read_config(const std::string &config_name)
+{
+    std::ifstream config_file(config_name);
+
+    Config result;
+
+    result.levels[0].off = 0;
+    result.levels[0].on = 0.1;
+    for(int i = 1; i < speed_levels_count; ++i)
+    {
+        config_file >> result.levels[i].off >> result.levels[i].on;
+    }
+    if(!config_file.good())
+        throw std::runtime_error("failed to read config file");
+
+    for(int i = 1; i < speed_levels_count; ++i)
+    {
+        if(result.levels[i - 1].off > result.levels[i].off)
+            throw std::runtime_error(
+                    "off temperatures are not non-decreasing with speed level");
+        if(result.levels[i - 1].on > result.levels[i].on)
+            throw std::runtime_error(
+                    "on temperatures are not non-decreasing with speed level");
+    }
+
+    for(int i = 0; i < speed_levels_count; ++i)
+        if(result.levels[i].on <= result.levels[i].off)
+            throw std::runtime_error(
+                    "on temperature is not greater than off temperature");
+
+    std::string mode;
+    if(config_file >> mode)
+    {
+        if(mode != "pid")
+            throw std::runtime_error("unknown control mode in config file");
+        Config::Pid &pid = result.pid;
+        config_file
+                >> pid.target_temperature
+                >> pid.proportional_gain
+                >> pid.integral_gain
+                >> pid.derivative_gain
+                >> pid.min_dwell
+                >> pid.level_deadband;
+        if(config_file.fail())
+            throw std::runtime_error("failed to read pid parameters");
+        if(
+                pid.proportional_gain < 0
+                || pid.integral_gain < 0
+                || pid.derivative_gain < 0
+                || pid.min_dwell < 0
+                || pid.level_deadband < 0)
+        {
+            throw std::runtime_error("pid parameters are negative");
+        }
+        pid.enabled = true;
+    }
+
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Controller class.
+ *
+ * Hysteresis between the speed levels and the choice of the interval to the
+ * next reading. It does no I/O, so the daemon and the simulation run the same
+ * logic.
+ *
+ * The hysteresis acts on the hottest sensor, by the temperature predicted from
+ * its smoothed value and the slope. Only rises are predicted, so the fans
+ * speed up ahead of a load spike but slow down on the actual temperature.
+ *
+ * In the PID mode the speed level is the rounded output of a PID loop on the
+ * smoothed temperature of the hottest sensor, with the derivative taken from
+ * its slope. The integral stops growing while the output is saturated, so it
+ * doesn't wind up at the top or the bottom level. The fans speed up at once,
+ * but a level is kept for at least the dwell time before they slow down, and
+ * the deadband keeps the output from dithering between two levels. */
+/*----------------------------------------------------------------------------*/
+class Controller
+{
+    Config m_config;
+    std::vector<Sensor_statistics> m_sensors;
+    int m_speed_level;
+    std::chrono::milliseconds m_interval;
+    double m_temperature;
+    double m_integral;
+    double m_previous_time;
+    double m_switch_time;
+    bool m_prediction;
+public:
+    Controller(const Config &config, const int sensor_count) :
+        m_config(config),
+        m_sensors(
+            sensor_count,
+            Sensor_statistics(history_lenght, ewma_time_constant)),
+        m_speed_level(0),
+        m_interval(min_update_period),
+        m_temperature(NAN),
+        m_integral(0),
+        m_previous_time(NAN),
+        m_switch_time(-INFINITY),
+        m_prediction(true)
+    {
+    }
+
+    /* Takes effect from the next update. The PID loop starts from the
+     * current level, so switching the mode doesn't bump the fans. */
+    void set_config(const Config &config)
+    {
+        if(config.pid.enabled && !m_config.pid.enabled)
+            m_integral = m_speed_level;
+        m_config = config;
+    }
+
+    /* Without the prediction the hysteresis acts on the smoothed
+     * temperature, for readings whose times are made up. */
+    void set_prediction(const bool enabled)
+    {
+        m_prediction = enabled;
+    }
+
+    /* time is in seconds, there is a temperature for every sensor */
+    void update(const double time, const std::vector<double> &temperatures)
+    {
+        const bool first = m_sensors[0].size() == 0;
+        double predicted = -INFINITY;
+        const Sensor_statistics *hottest = nullptr;
+        double max_rate = -INFINITY;
+        double max_change = 0;
+        for(std::size_t i = 0; i < m_sensors.size(); ++i)
+        {
+            Sensor_statistics &sensor = m_sensors[i];
+            sensor.update(time, temperatures[i]);
+            const double rise = m_prediction
+                    ? std::max(sensor.slope(), 0.0) * prediction_horizon
+                    : 0;
+            predicted = std::max(predicted, sensor.ewma() + rise);
+            if(!hottest || sensor.ewma() > hottest->ewma())
+                hottest = &sensor;
+            const double rate = sensor.last_rate();
+            max_rate = std::max(max_rate, rate);
+            max_change = std::max(
+                    max_change,
+                    std::abs(rate) * m_interval.count() / 1000);
+        }
+
+        if(m_config.pid.enabled)
+        {
+            m_temperature = hottest->ewma();
+            const int speed_level =
+                    pid_speed_level(time, m_temperature, hottest->slope());
+            if(
+                    speed_level > m_speed_level
+                    || (speed_level < m_speed_level
+                        && time - m_switch_time >= m_config.pid.min_dwell))
+            {
+                m_speed_level = speed_level;
+                m_switch_time = time;
+            }
+        }
+        else
+        {
+            m_temperature = predicted;
+            while(
+                    m_speed_level + 1 < speed_levels_count
+                    && m_temperature > m_config.levels[m_speed_level + 1].on)
+            {
+                ++m_speed_level;
+            }
+            while(
+                    m_speed_level - 1 >= 0
+                    && m_temperature < m_config.levels[m_speed_level].off)
+            {
+                --m_speed_level;
+            }
+        }
+        m_previous_time = time;
+
+        if(first || max_rate > fast_temperature_slope)
+            m_interval = min_update_period;
+        else if(max_change < stable_temperature_change)
+            m_interval = std::min(2 * m_interval, max_update_period);
+        else
+            m_interval = std::max(m_interval / 2, min_update_period);
+    }
+
+    /* the next reading is taken as soon as possible */
+    void alarm()
+    {
+        m_interval = min_update_period;
+    }
+
+    int speed_level() const
+    {
+        return m_speed_level;
+    }
+
+    /* the one the hysteresis acts on, predicted, or smoothed in the PID
+     * mode */
+    double temperature() const
+    {
+        return m_temperature;
+    }
+
+    /* the last reading of the hottest sensor */
+    double measured_temperature() const
+    {
+        double result = -INFINITY;
+        for(const Sensor_statistics &sensor : m_sensors)
+            result = std::max(result, sensor.last());
+        return result;
+    }
+
+    std::chrono::milliseconds interval() const
+    {
+        return m_interval;
+    }
+
+    const std::vector<Sensor_statistics> &sensors() const
+    {
+        return m_sensors;
+    }
+private:
+    int pid_speed_level(
+            const double time,
+            const double temperature,
+            const double slope)
+    {
+        const Config::Pid &pid = m_config.pid;
+        const double max_level = speed_levels_count - 1;
+        const double step =
+                std::isnan(m_previous_time) ? 0 : time - m_previous_time;
+        const double error = temperature - pid.target_temperature;
+        const double proportional_and_derivative =
+                pid.proportional_gain * error + pid.derivative_gain * slope;
+        const double integral = std::clamp(
+                m_integral + pid.integral_gain * error * step,
+                0.0,
+                max_level);
+        const double output = proportional_and_derivative + integral;
+        /* anti-windup by conditional integration */
+        if((output < max_level || error < 0) && (output > 0 || error > 0))
+            m_integral = integral;
+        const double level = std::clamp(
+                proportional_and_derivative + m_integral,
+                0.0,
+                max_level);
+        if(std::abs(level - m_speed_level) <= 0.5 + pid.level_deadband)
+            return m_speed_level;
+        return static_cast<int>(std::lround(level));
+    }
+};
+
+#endif /* HP_4510S_FAN_CONTROL_CONTROLLER_H */
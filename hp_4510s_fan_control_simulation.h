@@ -0,0 +1,246 @@
+/*
+ * SPDX-FileCopyrightText: 2016 Dominik Wójt <domin144@o2.pl>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef HP_4510S_FAN_CONTROL_SIMULATION_H
+#define HP_4510S_FAN_CONTROL_SIMULATION_H
+
+#include "hp_4510s_fan_control_controller.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/* Heat source switching between idle and load power as a square wave. Times
+ * are in milliseconds. */
+struct Heat_source
+{
+    double idle_power; /* W */
+    double load_power; /* W */
+    std::int64_t period;
+    std::int64_t load_duration;
+    std::int64_t phase;
+
+    double power(const std::int64_t time) const
+    {
+        return (time + phase) % period < load_duration
+                ? load_power
+                : idle_power;
+    }
+};
+
+/* Lumped thermal model of the laptop: a single heat capacity, heated by the
+ * sources and cooled to the ambient through a conductance, which grows with
+ * the speed level. */
+struct Thermal_model
+{
+    double heat_capacity = 40.0; /* J/K */
+    double ambient_temperature = 25.0;
+    double passive_conductance = 0.5; /* W/K */
+    double conductance_per_level = 0.35; /* W/K */
+    double fan_power_per_level = 0.4; /* W */
+    /* a processor under bursts of load and a steadier second source */
+    std::vector<Heat_source> heat_sources = {
+        {6.0, 30.0, 600000, 180000, 0},
+        {3.0, 12.0, 170000, 85000, 40000}};
+};
+
+/*----------------------------------------------------------------------------*/
+/* Thermal_simulation class.
+ *
+ * Integrates the model on a virtual clock, in steps of the minimal update
+ * period. Within a step the power and the conductance are constant, so the
+ * exact exponential approach to the equilibrium is used, with the decay per
+ * speed level computed up front. */
+/*----------------------------------------------------------------------------*/
+class Thermal_simulation
+{
+    const Thermal_model &m_model;
+    double m_decay[speed_levels_count];
+    double m_temperature;
+    std::int64_t m_time;
+public:
+    Thermal_simulation(const Thermal_model &model) :
+        m_model(model),
+        m_temperature(model.ambient_temperature),
+        m_time(0)
+    {
+        const double step = min_update_period.count() / 1000.0;
+        for(int i = 0; i < speed_levels_count; ++i)
+            m_decay[i] = std::exp(-conductance(i) * step / model.heat_capacity);
+    }
+
+    double temperature() const
+    {
+        return m_temperature;
+    }
+
+    void advance(
+            const std::chrono::milliseconds duration,
+            const int speed_level)
+    {
+        const std::int64_t end = m_time + duration.count();
+        for(; m_time < end; m_time += min_update_period.count())
+        {
+            double power = 0;
+            for(const Heat_source &source : m_model.heat_sources)
+                power += source.power(m_time);
+            const double equilibrium = m_model.ambient_temperature
+                    + power / conductance(speed_level);
+            m_temperature = equilibrium
+                    + (m_temperature - equilibrium) * m_decay[speed_level];
+        }
+    }
+
+    /* the trace of the model never ends */
+    bool finished() const
+    {
+        return false;
+    }
+private:
+    double conductance(const int speed_level) const
+    {
+        return m_model.passive_conductance
+                + m_model.conductance_per_level * speed_level;
+    }
+};
+
+/* Temperature recorded at a time, in milliseconds. */
+struct Trace_sample
+{
+    std::int64_t time;
+    double temperature;
+};
+
+/* Reads a trace with a line "SECONDS TEMPERATURE" for every sample, in the
+ * order of time. */
+inline std::vector<Trace_sample> read_trace(const std::string &trace_name)
+{
+    std::ifstream trace_file(trace_name);
+    if(!trace_file)
+        throw std::runtime_error("failed to open trace file");
+    std::vector<Trace_sample> result;
+    double seconds;
+    double temperature;
+    while(trace_file >> seconds >> temperature)
+    {
+        const std::int64_t time = std::llround(seconds * 1000);
+        if(!result.empty() && time < result.back().time)
+            throw std::runtime_error("trace samples are not ordered by time");
+        result.push_back({time, temperature});
+    }
+    if(!trace_file.eof())
+        throw std::runtime_error("failed to read trace file");
+    if(result.empty())
+        throw std::runtime_error("trace file is empty");
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Trace_replay class.
+ *
+ * Replays recorded temperatures: a reading gets the last sample taken at or
+ * before its time. The fans don't affect the recording, so only the decisions
+ * of the controller are scored, not the temperature. */
+/*----------------------------------------------------------------------------*/
+class Trace_replay
+{
+    const std::vector<Trace_sample> &m_trace;
+    std::size_t m_index;
+    std::int64_t m_time;
+public:
+    Trace_replay(const std::vector<Trace_sample> &trace) :
+        m_trace(trace),
+        m_index(0),
+        m_time(trace.front().time)
+    {
+    }
+
+    double temperature() const
+    {
+        return m_trace[m_index].temperature;
+    }
+
+    void advance(const std::chrono::milliseconds duration, int)
+    {
+        m_time += duration.count();
+        while(
+                m_index + 1 < m_trace.size()
+                && m_trace[m_index + 1].time <= m_time)
+        {
+            ++m_index;
+        }
+    }
+
+    bool finished() const
+    {
+        return m_time >= m_trace.back().time;
+    }
+};
+
+struct Simulation_score
+{
+    double peak_temperature = -INFINITY;
+    /* standard deviation over time, a measure of stability */
+    double temperature_deviation = 0;
+    std::uint64_t switch_count = 0;
+    double fan_energy = 0; /* J */
+    std::uint64_t tick_count = 0;
+};
+
+/* Runs the controller on the plant for the duration of virtual time, or until
+ * the plant is finished. The plant is Thermal_simulation or Trace_replay. */
+template<typename Plant>
+Simulation_score simulate(
+        const Config &config,
+        const Thermal_model &model,
+        Plant &plant,
+        const std::chrono::milliseconds duration)
+{
+    Simulation_score score;
+    Controller controller(config, 1);
+    std::vector<double> temperatures(1);
+    int speed_level = 0;
+    std::chrono::milliseconds time(0);
+    double temperature_integral = 0;
+    double temperature_squared_integral = 0;
+    while(time < duration && !plant.finished())
+    {
+        temperatures[0] = plant.temperature();
+        score.peak_temperature =
+                std::max(score.peak_temperature, temperatures[0]);
+        controller.update(time.count() / 1000.0, temperatures);
+        if(controller.speed_level() != speed_level)
+        {
+            speed_level = controller.speed_level();
+            ++score.switch_count;
+        }
+        const std::chrono::milliseconds interval = controller.interval();
+        const double seconds = interval.count() / 1000.0;
+        temperature_integral += temperatures[0] * seconds;
+        temperature_squared_integral +=
+                temperatures[0] * temperatures[0] * seconds;
+        plant.advance(interval, speed_level);
+        score.fan_energy += model.fan_power_per_level * speed_level * seconds;
+        time += interval;
+        ++score.tick_count;
+    }
+    if(time.count() > 0)
+    {
+        const double seconds = time.count() / 1000.0;
+        const double mean = temperature_integral / seconds;
+        score.temperature_deviation = std::sqrt(std::max(
+                temperature_squared_integral / seconds - mean * mean,
+                0.0));
+    }
+    return score;
+}
+
+#endif /* HP_4510S_FAN_CONTROL_SIMULATION_H */
@@ -0,0 +1,234 @@
+/*
+ * SPDX-FileCopyrightText: 2016 Dominik Wójt <domin144@o2.pl>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef HP_4510S_FAN_CONTROL_STATISTICS_H
+#define HP_4510S_FAN_CONTROL_STATISTICS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+/*----------------------------------------------------------------------------*/
+/* Monotonic_window class.
+ *
+ * Extreme of the last capacity values of a stream, in amortized O(1) per
+ * value. Only values which can still become the extreme are kept, in a ring,
+ * so Compare(front, others) holds. */
+/*----------------------------------------------------------------------------*/
+template<typename Compare>
+class Monotonic_window
+{
+    struct Entry
+    {
+        std::uint64_t index;
+        double value;
+    };
+
+    std::vector<Entry> m_entries;
+    std::uint64_t m_begin;
+    std::uint64_t m_end;
+    Compare m_compare;
+public:
+    Monotonic_window(const int capacity) :
+        m_entries(capacity),
+        m_begin(0),
+        m_end(0)
+    {
+    }
+
+    /* index of consecutive values, counted from 0 */
+    void push(const std::uint64_t index, const double value)
+    {
+        while(m_end != m_begin && !m_compare(back().value, value))
+            --m_end;
+        if(m_end != m_begin && index - front().index >= m_entries.size())
+            ++m_begin;
+        m_entries[m_end % m_entries.size()] = {index, value};
+        ++m_end;
+    }
+
+    double extreme() const
+    {
+        return front().value;
+    }
+private:
+    const Entry &front() const
+    {
+        return m_entries[m_begin % m_entries.size()];
+    }
+
+    const Entry &back() const
+    {
+        return m_entries[(m_end - 1) % m_entries.size()];
+    }
+};
+
+/*----------------------------------------------------------------------------*/
+/* Sensor_statistics class.
+ *
+ * Statistics of a window of the last samples of one sensor, all updated in
+ * O(1) per sample: mean, exponentially weighted moving average, minimum,
+ * maximum and the least squares slope.
+ *
+ * The running sums for the slope are kept with times relative to the newest
+ * sample, so they stay small however long the sensor runs. Every time the
+ * ring wraps around they are recomputed, so rounding errors don't pile up. */
+/*----------------------------------------------------------------------------*/
+class Sensor_statistics
+{
+    struct Sample
+    {
+        double time;
+        double value;
+    };
+
+    std::vector<Sample> m_samples;
+    std::uint64_t m_count;
+    double m_ewma_time_constant;
+    double m_ewma;
+    Monotonic_window<std::less<double>> m_min;
+    Monotonic_window<std::greater<double>> m_max;
+    double m_sum_value;
+    double m_sum_time;
+    double m_sum_time_squared;
+    double m_sum_time_value;
+public:
+    /* ewma_time_constant is in seconds, like the times of samples */
+    Sensor_statistics(const int capacity, const double ewma_time_constant) :
+        m_samples(capacity),
+        m_count(0),
+        m_ewma_time_constant(ewma_time_constant),
+        m_ewma(0),
+        m_min(capacity),
+        m_max(capacity),
+        m_sum_value(0),
+        m_sum_time(0),
+        m_sum_time_squared(0),
+        m_sum_time_value(0)
+    {
+        if(capacity < 2)
+            throw std::invalid_argument("statistics need at least 2 samples");
+    }
+
+    /* times have to increase */
+    void update(const double time, const double value)
+    {
+        const int capacity = static_cast<int>(m_samples.size());
+        if(m_count == 0)
+        {
+            m_ewma = value;
+        }
+        else
+        {
+            const double delta = time - last_sample().time;
+            m_ewma += (value - m_ewma)
+                    * (1 - std::exp(-delta / m_ewma_time_constant));
+
+            /* move the origin of times to the new sample */
+            const int size = this->size();
+            m_sum_time_squared +=
+                    -2 * delta * m_sum_time + size * delta * delta;
+            m_sum_time_value -= delta * m_sum_value;
+            m_sum_time -= size * delta;
+            if(size == capacity)
+            {
+                const Sample &oldest = m_samples[m_count % capacity];
+                const double oldest_time = oldest.time - time;
+                m_sum_value -= oldest.value;
+                m_sum_time -= oldest_time;
+                m_sum_time_squared -= oldest_time * oldest_time;
+                m_sum_time_value -= oldest_time * oldest.value;
+            }
+        }
+        m_min.push(m_count, value);
+        m_max.push(m_count, value);
+        m_samples[m_count % capacity] = {time, value};
+        ++m_count;
+        m_sum_value += value;
+        if(m_count % capacity == 0)
+            recompute_sums();
+    }
+
+    int size() const
+    {
+        return static_cast<int>(
+                std::min<std::uint64_t>(m_count, m_samples.size()));
+    }
+
+    double last() const
+    {
+        return last_sample().value;
+    }
+
+    /* change per second between the two last samples, 0 if there is one */
+    double last_rate() const
+    {
+        if(m_count < 2)
+            return 0;
+        const Sample &last = last_sample();
+        const Sample &previous = m_samples[(m_count - 2) % m_samples.size()];
+        return (last.value - previous.value) / (last.time - previous.time);
+    }
+
+    double mean() const
+    {
+        return m_sum_value / size();
+    }
+
+    double ewma() const
+    {
+        return m_ewma;
+    }
+
+    double min() const
+    {
+        return m_min.extreme();
+    }
+
+    double max() const
+    {
+        return m_max.extreme();
+    }
+
+    /* least squares fit, per second, 0 if there is one sample */
+    double slope() const
+    {
+        const int size = this->size();
+        const double denominator =
+                size * m_sum_time_squared - m_sum_time * m_sum_time;
+        if(size < 2 || denominator <= 0)
+            return 0;
+        return (size * m_sum_time_value - m_sum_time * m_sum_value)
+                / denominator;
+    }
+private:
+    const Sample &last_sample() const
+    {
+        return m_samples[(m_count - 1) % m_samples.size()];
+    }
+
+    void recompute_sums()
+    {
+        const double origin = last_sample().time;
+        m_sum_value = 0;
+        m_sum_time = 0;
+        m_sum_time_squared = 0;
+        m_sum_time_value = 0;
+        for(const Sample &sample : m_samples)
+        {
+            const double time = sample.time - origin;
+            m_sum_value += sample.value;
+            m_sum_time += time;
+            m_sum_time_squared += time * time;
+            m_sum_time_value += time * sample.value;
+        }
+    }
+};
+
+#endif /* HP_4510S_FAN_CONTROL_STATISTICS_H */
@@ -0,0 +1,161 @@
+/*
+ * SPDX-FileCopyrightText: 2016 Dominik Wójt <domin144@o2.pl>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "hp_4510s_fan_control_statistics.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+bool near(const double value, const double expected)
+{
+    return std::abs(value - expected)
+            <= 1e-9 * std::max(1.0, std::abs(expected));
+}
+
+/* The extremes of a window of 3 values, where the extreme leaves the window
+ * while newer values are still in it. */
+void check_window()
+{
+    Monotonic_window<std::less<double>> min(3);
+    const double min_values[] = {5, 3, 4, 6, 7, 8, 2};
+    const double expected_mins[] = {5, 3, 3, 3, 4, 6, 2};
+    for(std::size_t i = 0; i < std::size(min_values); ++i)
+    {
+        min.push(i, min_values[i]);
+        my_assert(min.extreme() == expected_mins[i], "wrong window minimum");
+    }
+
+    Monotonic_window<std::greater<double>> max(3);
+    const double max_values[] = {1, 9, 2, 3, 4, 4, 1};
+    const double expected_maxes[] = {1, 9, 9, 9, 4, 4, 4};
+    for(std::size_t i = 0; i < std::size(max_values); ++i)
+    {
+        max.push(i, max_values[i]);
+        my_assert(max.extreme() == expected_maxes[i], "wrong window maximum");
+    }
+}
+
+/* Least squares slope of the last capacity samples, computed directly. */
+double reference_slope(
+        const std::vector<double> &times,
+        const std::vector<double> &values,
+        const std::size_t capacity)
+{
+    const std::size_t begin =
+            times.size() > capacity ? times.size() - capacity : 0;
+    const double size = times.size() - begin;
+    double mean_time = 0;
+    double mean_value = 0;
+    for(std::size_t i = begin; i < times.size(); ++i)
+    {
+        mean_time += times[i] / size;
+        mean_value += values[i] / size;
+    }
+    double covariance = 0;
+    double variance = 0;
+    for(std::size_t i = begin; i < times.size(); ++i)
+    {
+        covariance += (times[i] - mean_time) * (values[i] - mean_value);
+        variance += (times[i] - mean_time) * (times[i] - mean_time);
+    }
+    return variance == 0 ? 0 : covariance / variance;
+}
+
+/* A line, far from time 0, has the exact slope and rate, and its window
+ * holds the last 4 values. */
+void check_line()
+{
+    Sensor_statistics statistics(4, 2.0);
+    const double start = 1e6;
+    for(int i = 0; i < 10; ++i)
+    {
+        statistics.update(start + i, 2 * i + 1);
+        const int first = std::max(i - 3, 0);
+        my_assert(statistics.size() == i - first + 1, "wrong size");
+        my_assert(statistics.last() == 2 * i + 1, "wrong last value");
+        my_assert(statistics.min() == 2 * first + 1, "wrong minimum");
+        my_assert(statistics.max() == 2 * i + 1, "wrong maximum");
+        my_assert(near(statistics.mean(), first + i + 1), "wrong mean");
+        my_assert(
+                near(statistics.slope(), i == 0 ? 0 : 2),
+                "wrong slope of a line");
+        my_assert(
+                statistics.last_rate() == (i == 0 ? 0 : 2),
+                "wrong last rate");
+    }
+}
+
+/* A step by 10 is followed by 1 - e^(-delta / time constant) of it. */
+void check_ewma()
+{
+    Sensor_statistics statistics(2, 2.0);
+    statistics.update(0, 0);
+    my_assert(statistics.ewma() == 0, "ewma doesn't start at the value");
+    statistics.update(2, 10);
+    my_assert(near(statistics.ewma(), 10 * (1 - std::exp(-1.0))), "wrong ewma");
+    statistics.update(4, 10);
+    my_assert(
+            near(statistics.ewma(), 10 * (1 - std::exp(-2.0))),
+            "wrong ewma");
+}
+
+/* Random samples at uneven times, through many wraps of the ring, against
+ * the extremes and the slope computed directly. */
+void check_random()
+{
+    const std::size_t capacity = 5;
+    Sensor_statistics statistics(capacity, 2.0);
+    std::mt19937 gen(15);
+    std::uniform_real_distribution<double> step(0.25, 8);
+    std::uniform_real_distribution<double> temperature(30, 90);
+    std::vector<double> times;
+    std::vector<double> values;
+    double time = 0;
+    for(int i = 0; i < 1000; ++i)
+    {
+        time += step(gen);
+        times.push_back(time);
+        values.push_back(temperature(gen));
+        statistics.update(time, values.back());
+
+        const auto window_begin =
+                values.end() - std::min(values.size(), capacity);
+        const auto window_end = values.end();
+        my_assert(
+                statistics.min() == *std::min_element(window_begin, window_end),
+                "wrong minimum of random samples");
+        my_assert(
+                statistics.max() == *std::max_element(window_begin, window_end),
+                "wrong maximum of random samples");
+        const double slope = reference_slope(times, values, capacity);
+        my_assert(
+                std::abs(statistics.slope() - slope) < 1e-6,
+                "wrong slope of random samples");
+    }
+}
+
+int main() try
+{
+    check_window();
+    check_line();
+    check_ewma();
+    check_random();
+    std::cout << "statistics ok\n";
+    return 0;
+}
+catch(std::exception &e)
+{
+    std::cerr << "std::exception caught: " << e.what() << '\n';
+    return -1;
+}
@@ -4,46 +4,328 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include "big_integer.h"
+#include "thread_pool.h"
+#include "utils.h"
+
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <iostream>
 #include <iomanip>
 #include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
 
-std::uint32_t compute_pi_times_2_to_30_low()
+/* The AVX2 kernel is built whatever the target flags, and chosen at run time
+ * when the CPU has AVX2. */
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HAVE_AVX2_KERNEL 1
+#include <immintrin.h>
+#endif
+
+/* Largest x with x * x <= n. */
+std::uint64_t integer_sqrt(const std::uint64_t n)
+{
+    std::uint64_t x = static_cast<std::uint64_t>(
+            std::sqrt(static_cast<double>(n)));
+    x = std::min<std::uint64_t>(x, 0xffffffffu);
+    while (x * x > n)
+        --x;
+    while (x < 0xffffffffu && (x + 1u) * (x + 1u) <= n)
+        ++x;
+    return x;
+}
+
+/* Sum of x_low over rows [y_begin, y_end), 1 <= y_begin. x_low is seeded with
+ * the value the loop keeps from the previous rows, so any range of rows can be
+ * summed on its own. */
+std::uint64_t sum_rows_low(
+        const std::uint64_t y_begin,
+        const std::uint64_t y_end)
 {
-    /* result is pi * 2^32 / 4, which is surface of quarter of a circle with
-     * r = 2^32 divided by 2^32 */
     std::uint64_t result_low = 0;
     std::uint64_t r = 0x100000000ull;
-    std::uint64_t x_low = r;
-    x_low--;
-    for (std::uint64_t y = 1; y <= r; ++y)
+    std::uint64_t x_low = integer_sqrt(r * r - y_begin * y_begin);
+    for (std::uint64_t y = y_begin; y < y_end; ++y)
     {
         while (x_low * x_low > r * r - y * y)
             --x_low;
         result_low += x_low;
     }
-    return result_low >> 32u;
+    return result_low;
 }
 
-std::uint32_t compute_pi_times_2_to_30_high()
+/* Sum of x_high over rows [y_begin, y_end), seeded like in sum_rows_low. */
+std::uint64_t sum_rows_high(
+        const std::uint64_t y_begin,
+        const std::uint64_t y_end)
 {
-    /* result is pi * 2^32 / 4, which is surface of quarter of a circle with
-     * r = 2^32 divided by 2^32 */
     std::uint64_t r = 0x100000000ull;
     std::uint64_t result_high = 0;
-    std::uint64_t x_high = r;
-    for (std::uint64_t y = 0; y < r; ++y)
+    std::uint64_t x_high = integer_sqrt(r * r - y_begin * y_begin - 1u) + 1u;
+    for (std::uint64_t y = y_begin; y < y_end; ++y)
     {
         while ((x_high - 1u) * (x_high - 1u) - 1u >= r * r - y * y - 1u)
             --x_high;
         result_high += x_high;
     }
-    return (result_high + 0xfffffffful) >> 32u;
+    return result_high;
+}
+
+#if defined(HAVE_AVX2_KERNEL)
+/* Rows below this one have x falling by less than 1 per row: the exact drop
+ * (2 y + 1) / (x(y) + x(y + 1)) stays below 1 for y < r / sqrt(2). */
+constexpr std::uint64_t stepped_rows_end = 0x100000000ull / 10u * 7u;
+
+/* x_low or x_high - 1 of rows [y_begin, y_end), all below stepped_rows_end.
+ * The rows are split into one contiguous run for each of 32 lanes, and x of
+ * each lane is stepped down by at most one per row, without a branch. There
+ * are 8 independent vectors, to hide the latency of the multiplication. */
+template<bool high>
+__attribute__((target("avx2")))
+std::uint64_t sum_rows_stepped(
+        const std::uint64_t y_begin,
+        const std::uint64_t y_end)
+{
+    constexpr int vector_count = 8;
+    constexpr int lane_count = 4 * vector_count;
+    std::uint64_t r = 0x100000000ull;
+    const std::uint64_t lane_rows = (y_end - y_begin) / lane_count;
+    /* unsigned comparison with the signed one, on flipped sign bits */
+    const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    const __m256i one = _mm256_set1_epi64x(1);
+    __m256i ys[vector_count];
+    __m256i xs[vector_count];
+    __m256i sums[vector_count];
+    for (int i = 0; i < vector_count; ++i)
+    {
+        alignas(32) std::uint64_t lane_ys[4];
+        alignas(32) std::uint64_t lane_xs[4];
+        for (int j = 0; j < 4; ++j)
+        {
+            const std::uint64_t y = y_begin + lane_rows * (4 * i + j);
+            lane_ys[j] = y;
+            lane_xs[j] = integer_sqrt(r * r - y * y - (high ? 1u : 0u));
+        }
+        ys[i] = _mm256_load_si256(reinterpret_cast<const __m256i *>(lane_ys));
+        xs[i] = _mm256_load_si256(reinterpret_cast<const __m256i *>(lane_xs));
+        sums[i] = _mm256_setzero_si256();
+    }
+    for (std::uint64_t k = 0; k < lane_rows; ++k)
+    {
+        for (int i = 0; i < vector_count; ++i)
+        {
+            sums[i] = _mm256_add_epi64(sums[i], xs[i]);
+            ys[i] = _mm256_add_epi64(ys[i], one);
+            __m256i n = _mm256_sub_epi64(
+                    _mm256_setzero_si256(),
+                    _mm256_mul_epu32(ys[i], ys[i]));
+            if (high)
+                n = _mm256_sub_epi64(n, one);
+            const __m256i too_big = _mm256_cmpgt_epi64(
+                    _mm256_xor_si256(_mm256_mul_epu32(xs[i], xs[i]), sign),
+                    _mm256_xor_si256(n, sign));
+            xs[i] = _mm256_add_epi64(xs[i], too_big);
+        }
+    }
+    std::uint64_t result = 0;
+    for (int i = 0; i < vector_count; ++i)
+    {
+        alignas(32) std::uint64_t lane_sums[4];
+        _mm256_store_si256(reinterpret_cast<__m256i *>(lane_sums), sums[i]);
+        result += lane_sums[0] + lane_sums[1] + lane_sums[2] + lane_sums[3];
+    }
+    for (std::uint64_t y = y_begin + lane_count * lane_rows; y < y_end; ++y)
+        result += integer_sqrt(r * r - y * y - (high ? 1u : 0u));
+    return result;
+}
+
+/* x_low or x_high - 1 of rows [y_begin, y_end), where x falls fast and every
+ * row gets its x directly, four rows at once. The root is estimated with
+ * a double sqrt, which is off by at most one, and corrected once in each
+ * direction with exact 32x32->64 bit squares. */
+template<bool high>
+__attribute__((target("avx2")))
+std::uint64_t sum_rows_direct(
+        const std::uint64_t y_begin,
+        const std::uint64_t y_end)
+{
+    std::uint64_t r = 0x100000000ull;
+    std::uint64_t y = y_begin;
+    /* integers below 2^52 convert to and from double through the mantissa
+     * of 2^52 */
+    const __m256d magic = _mm256_set1_pd(4503599627370496.0);
+    const __m256i magic_bits = _mm256_castpd_si256(magic);
+    const __m256d r_double = _mm256_set1_pd(4294967296.0);
+    const __m256d max_root_double = _mm256_set1_pd(4294967295.0);
+    const __m256i max_root = _mm256_set1_epi64x(0xffffffffll);
+    const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+    const __m256i one = _mm256_set1_epi64x(1);
+    const __m256i four = _mm256_set1_epi64x(4);
+    __m256i ys = _mm256_setr_epi64x(y, y + 1u, y + 2u, y + 3u);
+    __m256i sums = _mm256_setzero_si256();
+    for (; y_end - y >= 4u; y += 4u)
+    {
+        const __m256d y_double = _mm256_sub_pd(
+                _mm256_castsi256_pd(_mm256_or_si256(ys, magic_bits)),
+                magic);
+        const __m256d n_double = _mm256_mul_pd(
+                _mm256_sub_pd(r_double, y_double),
+                _mm256_add_pd(r_double, y_double));
+        const __m256d root_double = _mm256_min_pd(
+                _mm256_floor_pd(_mm256_sqrt_pd(n_double)),
+                max_root_double);
+        __m256i root = _mm256_sub_epi64(
+                _mm256_castpd_si256(_mm256_add_pd(root_double, magic)),
+                magic_bits);
+
+        /* r^2 - y^2 modulo 2^64, y = r only squares to 0 as the low 32
+         * bits are multiplied */
+        __m256i n = _mm256_sub_epi64(
+                _mm256_setzero_si256(),
+                _mm256_mul_epu32(ys, ys));
+        if (high)
+            n = _mm256_sub_epi64(n, one);
+        const __m256i n_signed = _mm256_xor_si256(n, sign);
+
+        const __m256i too_big = _mm256_cmpgt_epi64(
+                _mm256_xor_si256(_mm256_mul_epu32(root, root), sign),
+                n_signed);
+        root = _mm256_add_epi64(root, too_big);
+        const __m256i next = _mm256_add_epi64(root, one);
+        const __m256i next_too_big = _mm256_or_si256(
+                _mm256_cmpgt_epi64(
+                    _mm256_xor_si256(_mm256_mul_epu32(next, next), sign),
+                    n_signed),
+                _mm256_cmpeq_epi64(root, max_root));
+        root = _mm256_add_epi64(root, _mm256_andnot_si256(next_too_big, one));
+
+        sums = _mm256_add_epi64(sums, root);
+        ys = _mm256_add_epi64(ys, four);
+    }
+    alignas(32) std::uint64_t lane_sums[4];
+    _mm256_store_si256(reinterpret_cast<__m256i *>(lane_sums), sums);
+    std::uint64_t result =
+            lane_sums[0] + lane_sums[1] + lane_sums[2] + lane_sums[3];
+    for (; y < y_end; ++y)
+        result += integer_sqrt(r * r - y * y - (high ? 1u : 0u));
+    return result;
 }
 
-int main()
+/* Sum of x over rows [y_begin, y_end), where x_low = isqrt(r^2 - y^2), or
+ * x_high = isqrt(r^2 - y^2 - 1) + 1, computed for every row on its own, so
+ * with AVX2 many rows can be done at once. The results are identical to
+ * sum_rows_low and sum_rows_high. */
+template<bool high>
+__attribute__((target("avx2")))
+std::uint64_t sum_rows_vectorized(
+        const std::uint64_t y_begin,
+        const std::uint64_t y_end)
+{
+    std::uint64_t result = high ? y_end - y_begin : 0u;
+    const std::uint64_t y_middle =
+            std::min(std::max(y_begin, stepped_rows_end), y_end);
+    result += sum_rows_stepped<high>(y_begin, y_middle);
+    result += sum_rows_direct<high>(y_middle, y_end);
+    return result;
+}
+#endif
+
+/* Kernels summing a range of rows, for low and high variants. */
+struct Lattice_kernel
+{
+    const char *name;
+    std::uint64_t (*sum_rows_low)(std::uint64_t, std::uint64_t);
+    std::uint64_t (*sum_rows_high)(std::uint64_t, std::uint64_t);
+};
+
+const Lattice_kernel scalar_kernel{"scalar", sum_rows_low, sum_rows_high};
+
+#if defined(HAVE_AVX2_KERNEL)
+const Lattice_kernel vectorized_kernel{
+    "vectorized",
+    sum_rows_vectorized<false>,
+    sum_rows_vectorized<true>};
+#endif
+
+/* The vectorized kernel where the CPU can run it. */
+const Lattice_kernel &default_kernel()
+{
+#if defined(HAVE_AVX2_KERNEL)
+    if (__builtin_cpu_supports("avx2"))
+        return vectorized_kernel;
+#endif
+    return scalar_kernel;
+}
+
+/* Rows are split into many more chunks than there are threads, as with the
+ * scalar kernel the rows near y = r take many more steps of x. Partial sums
+ * are added in chunk order, so the result doesn't depend on the scheduling. */
+constexpr int row_chunk_count = 1024;
+
+template<typename Sum_rows>
+std::uint64_t sum_rows_parallel(
+        Thread_pool &pool,
+        const std::uint64_t y_begin,
+        const std::uint64_t y_end,
+        const Sum_rows &sum_rows)
+{
+    const std::uint64_t row_count = y_end - y_begin;
+    std::vector<std::uint64_t> sums(row_chunk_count);
+    pool.run(
+            row_chunk_count,
+            [&](const int i)
+            {
+                sums[i] = sum_rows(
+                        y_begin + row_count * i / row_chunk_count,
+                        y_begin + row_count * (i + 1) / row_chunk_count);
+            });
+    std::uint64_t result = 0;
+    for (const std::uint64_t sum : sums)
+        result += sum;
+    return result;
+}
+
+std::uint32_t compute_pi_times_2_to_30_low()
+{
+    /* result is pi * 2^32 / 4, which is surface of quarter of a circle with
+     * r = 2^32 divided by 2^32 */
+    std::uint64_t r = 0x100000000ull;
+    return sum_rows_low(1, r + 1u) >> 32u;
+}
+
+std::uint32_t compute_pi_times_2_to_30_high()
+{
+    /* result is pi * 2^32 / 4, which is surface of quarter of a circle with
+     * r = 2^32 divided by 2^32 */
+    std::uint64_t r = 0x100000000ull;
+    return (sum_rows_high(0, r) + 0xfffffffful) >> 32u;
+}
+
+std::uint32_t compute_pi_times_2_to_30_low(
+        Thread_pool &pool,
+        const Lattice_kernel &kernel = default_kernel())
+{
+    std::uint64_t r = 0x100000000ull;
+    return sum_rows_parallel(pool, 1, r + 1u, kernel.sum_rows_low) >> 32u;
+}
+
+std::uint32_t compute_pi_times_2_to_30_high(
+        Thread_pool &pool,
+        const Lattice_kernel &kernel = default_kernel())
+{
+    std::uint64_t r = 0x100000000ull;
+    return (sum_rows_parallel(pool, 0, r, kernel.sum_rows_high) + 0xfffffffful)
+            >> 32u;
+}
+
+void print_pi(const std::uint32_t pi_times_2_to_30)
 {
-    std::uint32_t pi_times_2_to_30 = compute_pi_times_2_to_30_low();
     std::uint32_t two_to_30 = static_cast<std::uint32_t>(1) << 30;
     std::uint32_t pi_integer = pi_times_2_to_30 / two_to_30;
     std::uint32_t pi_fraction =
@@ -58,5 +340,324 @@ int main()
             << std::setw(9)
             << std::setfill('0')
             << pi_fraction_1000000000 << std::endl;
+}
+
+/* P, Q and T of the terms [a, b) of the Chudnovsky series, with the sign of T
+ * kept apart, as Big_integer has none. */
+struct Chudnovsky_terms
+{
+    Big_integer p;
+    Big_integer q;
+    Big_integer t;
+    bool t_negative;
+};
+
+/* value += other, on magnitudes with signs */
+void add_signed(
+        Big_integer &value,
+        bool &negative,
+        const Big_integer &other,
+        const bool other_negative)
+{
+    if (negative == other_negative)
+    {
+        value = value + other;
+    }
+    else if (compare(value, other) >= 0)
+    {
+        value = value - other;
+    }
+    else
+    {
+        value = other - value;
+        negative = other_negative;
+    }
+    if (value.is_zero())
+        negative = false;
+}
+
+/* The factors of the terms are computed in 64 bits, (2 a - 1) (6 a - 1) is
+ * the first to overflow, past this many terms. */
+const std::uint64_t max_chudnovsky_terms = 1000000000;
+
+/* Binary splitting, so the products are of operands of similar size, where
+ * the fast multiplications pay off. */
+Chudnovsky_terms chudnovsky_terms(const std::uint64_t a, const std::uint64_t b)
+{
+    if (b - a == 1)
+    {
+        if (a == 0)
+            return {1, 1, 13591409, false};
+        /* C^3 / 24 with C = 640320 */
+        const std::uint64_t c_cubed_over_24 = 10939058860032000ull;
+        Chudnovsky_terms result;
+        result.p = Big_integer(6 * a - 5)
+                * Big_integer((2 * a - 1) * (6 * a - 1));
+        result.q = Big_integer(a) * Big_integer(a * a)
+                * Big_integer(c_cubed_over_24);
+        result.t = result.p * Big_integer(13591409 + 545140134 * a);
+        result.t_negative = a % 2 != 0;
+        return result;
+    }
+    const std::uint64_t middle = (a + b) / 2;
+    const Chudnovsky_terms left = chudnovsky_terms(a, middle);
+    const Chudnovsky_terms right = chudnovsky_terms(middle, b);
+    Chudnovsky_terms result;
+    result.p = left.p * right.p;
+    result.q = left.q * right.q;
+    result.t = right.q * left.t;
+    result.t_negative = left.t_negative;
+    add_signed(result.t, result.t_negative, left.p * right.t, right.t_negative);
+    return result;
+}
+
+/* Fixed point numbers below are Big_integers scaled by base^precision. */
+
+/* base^precision / x, where x = divisor / base^divisor.size() is in
+ * [1 / base, 1). Newton's iteration x' = x (2 - d x) doubles the precision
+ * in every step, the last step is repeated at full precision to absorb the
+ * truncation errors of the previous ones. */
+Big_integer reciprocal(const Big_integer &divisor, const std::size_t precision)
+{
+    const Big_integer::Limbs &limbs = divisor.limbs();
+    const std::size_t size = limbs.size();
+    double top = 0.0;
+    for (std::size_t i = std::min<std::size_t>(size, 3); i-- > 0;)
+        top = (top + limbs[size - 1 - i]) / Big_integer::base;
+    const double inverse = 1.0 / top;
+    const double integer_part = std::floor(inverse);
+    Big_integer result =
+            Big_integer(static_cast<std::uint64_t>(integer_part)).shift_left(2)
+            + Big_integer(static_cast<std::uint64_t>(
+                (inverse - integer_part) * 1e18));
+
+    std::size_t current = 2;
+    for (bool last = false; !last;)
+    {
+        const std::size_t next = std::min(2 * current, precision);
+        last = next == current;
+        result = result.shift_left(next - current);
+        const Big_integer scaled_divisor = size > next
+                ? divisor.shift_right(size - next)
+                : divisor.shift_left(next - size);
+        /* d x is kept at double precision, as x can be close to base and
+         * would multiply its truncation error */
+        const Big_integer product = scaled_divisor * result;
+        result = (result * (Big_integer(2).shift_left(2 * next) - product))
+                .shift_right(2 * next);
+        current = next;
+    }
+    return result;
+}
+
+/* base^precision / sqrt(value), with Newton's iteration
+ * y' = y (3 - v y^2) / 2, doubling the precision like reciprocal. */
+Big_integer inverse_sqrt(const std::uint32_t value, const std::size_t precision)
+{
+    Big_integer result(static_cast<std::uint64_t>(1e18 / std::sqrt(value)));
+    std::size_t current = 2;
+    for (bool last = false; !last;)
+    {
+        const std::size_t next = std::min(2 * current, precision);
+        last = next == current;
+        result = result.shift_left(next - current);
+        const Big_integer square = result * result * Big_integer(value);
+        result = (result * (Big_integer(3).shift_left(2 * next) - square))
+                .shift_right(2 * next)
+                .divide(2);
+        current = next;
+    }
+    return result;
+}
+
+/* Decimal digits of pi, starting with the leading 3, computed with two guard
+ * limbs.
+ *
+ * pi = 426880 sqrt(10005) Q / T, where the term of a = 0 brings the usual
+ * 13591409 Q into T. */
+std::string compute_pi_digits(const std::size_t digit_count)
+{
+    /* every term adds about 14.18 digits */
+    const std::uint64_t term_count = digit_count / 14.181647462725477 + 2;
+    if (term_count > max_chudnovsky_terms)
+        throw std::runtime_error("too many digits requested");
+    const std::size_t precision =
+            digit_count / Big_integer::base_digits + 2;
+
+    Chudnovsky_terms terms;
+    {
+        Timer timer("binary splitting");
+        terms = chudnovsky_terms(0, term_count);
+    }
+
+    Big_integer quotient;
+    {
+        Timer timer("division");
+        const Big_integer inverse = reciprocal(terms.t, precision);
+        /* only the leading limbs of Q matter */
+        const std::size_t skipped = terms.q.size() > precision + 2
+                ? terms.q.size() - precision - 2
+                : 0;
+        quotient = (terms.q.shift_right(skipped) * inverse)
+                .shift_right(terms.t.size() - skipped);
+    }
+
+    Big_integer root;
+    {
+        Timer timer("square root");
+        root = inverse_sqrt(10005, precision) * Big_integer(10005);
+    }
+
+    Big_integer pi;
+    {
+        Timer timer("final multiplication");
+        pi = (quotient * root).shift_right(precision) * Big_integer(426880);
+    }
+
+    Timer timer("conversion to decimal");
+    return pi.to_string().substr(0, digit_count + 1);
+}
+
+/* The lattice counts bound pi * 2^30 from below and above, the digits have to
+ * fall in between. */
+bool verify_pi_digits(const std::string &digits, Thread_pool &pool)
+{
+    Timer timer("verification");
+    const std::uint64_t pi_times_10_to_18 = std::stoull(digits.substr(0, 19));
+    const std::uint64_t pi_times_2_to_30 = static_cast<std::uint64_t>(
+            (static_cast<unsigned __int128>(pi_times_10_to_18) << 30u)
+            / 1000000000000000000ull);
+    return compute_pi_times_2_to_30_low(pool) <= pi_times_2_to_30
+            && pi_times_2_to_30 <= compute_pi_times_2_to_30_high(pool);
+}
+
+/* Compares the kernels on one thread, checking that the row sums are the
+ * same to the last bit, then runs the default kernel with 1, 2, 4, ...
+ * threads up to max_thread_count. Reports rows per second and the speedup. */
+void benchmark(const int max_thread_count)
+{
+    using Clock = std::chrono::steady_clock;
+    const std::uint64_t r = 0x100000000ull;
+    const double row_count = 2.0 * r;
+
+    std::uint64_t reference_low = 0;
+    std::uint64_t reference_high = 0;
+    double scalar_time = 0.0;
+    std::vector<const Lattice_kernel *> kernels{&scalar_kernel};
+    if (&default_kernel() != &scalar_kernel)
+        kernels.push_back(&default_kernel());
+    for (const Lattice_kernel *kernel : kernels)
+    {
+        const Clock::time_point start = Clock::now();
+        const std::uint64_t low = kernel->sum_rows_low(1, r + 1u);
+        const std::uint64_t high = kernel->sum_rows_high(0, r);
+        const std::chrono::duration<double> time = Clock::now() - start;
+        if (kernel == &scalar_kernel)
+        {
+            reference_low = low;
+            reference_high = high;
+            scalar_time = time.count();
+        }
+        else if (low != reference_low || high != reference_high)
+        {
+            std::cerr << kernel->name << " kernel result differs!\n";
+        }
+        std::cout
+                << kernel->name << " kernel: " << time.count() << " s, "
+                << row_count / time.count() << " rows/s, speedup "
+                << scalar_time / time.count() << '\n';
+    }
+
+    double single_thread_time = 0.0;
+    for (int thread_count = 1;; thread_count *= 2)
+    {
+        thread_count = std::min(thread_count, max_thread_count);
+        Thread_pool pool(thread_count);
+        const Clock::time_point start = Clock::now();
+        const std::uint32_t low = compute_pi_times_2_to_30_low(pool);
+        const std::uint32_t high = compute_pi_times_2_to_30_high(pool);
+        const std::chrono::duration<double> time = Clock::now() - start;
+        if (thread_count == 1)
+            single_thread_time = time.count();
+        if (low != reference_low >> 32u
+                || high != (reference_high + 0xfffffffful) >> 32u)
+        {
+            std::cerr << "parallel result differs!\n";
+        }
+        std::cout
+                << thread_count << " threads: " << time.count() << " s, "
+                << row_count / time.count() << " rows/s, speedup "
+                << single_thread_time / time.count() << '\n';
+        if (thread_count == max_thread_count)
+            break;
+    }
+}
+
+namespace po = boost::program_options;
+
+int main(const int argc, const char *const argv[]) try
+{
+    po::options_description description(
+            "Computes pi by counting lattice points in a quarter of a circle.\n"
+            "Allowed options");
+    description.add_options()
+            ("help", "show help")
+            ("benchmark", "measure scaling with the number of threads")
+            ("threads",
+             po::value<int>()->default_value(
+                 std::max<int>(std::thread::hardware_concurrency(), 1)),
+             "number of threads")
+            ("high", "count the points touching the circle too")
+            ("scalar", "use the scalar kernel instead of the vectorized one")
+            ("digits",
+             po::value<std::size_t>(),
+             "compute this many decimal digits with the Chudnovsky series")
+            ("verify", "check the digits against the lattice point count");
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, description), vm);
+    po::notify(vm);
+
+    const int thread_count = std::max(vm["threads"].as<int>(), 1);
+    if (vm.count("help"))
+    {
+        std::cout << description << '\n';
+    }
+    else if (vm.count("benchmark"))
+    {
+        benchmark(thread_count);
+    }
+    else if (vm.count("digits"))
+    {
+        /* the verification needs 18 digits */
+        const std::size_t digit_count = vm["digits"].as<std::size_t>();
+        const std::string digits =
+                compute_pi_digits(std::max<std::size_t>(digit_count, 18));
+        std::cout
+                << "pi ~= " << digits[0] << '.'
+                << digits.substr(1, digit_count) << std::endl;
+        if (vm.count("verify"))
+        {
+            Thread_pool pool(thread_count);
+            if (!verify_pi_digits(digits, pool))
+                throw std::runtime_error("digits disagree with lattice count");
+            std::cerr << "digits agree with lattice count\n";
+        }
+    }
+    else
+    {
+        Thread_pool pool(thread_count);
+        const Lattice_kernel &kernel =
+                vm.count("scalar") ? scalar_kernel : default_kernel();
+        print_pi(
+                vm.count("high")
+                ? compute_pi_times_2_to_30_high(pool, kernel)
+                : compute_pi_times_2_to_30_low(pool, kernel));
+    }
     return 0;
 }
+catch (std::exception &e)
+{
+    std::cerr << "std::exception caught: " << e.what() << '\n';
+    return -1;
+}
@@ -4,31 +4,188 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include "plplot_playground_decimation.h"
+
+#include <boost/program_options.hpp>
+
+#include <algorithm>
 #include <iostream>
+#include <string>
+#include <vector>
 #include <plplot/plstream.h>
 
-int main(int argc, const char *argv[])
+/* A series decimated to what can be seen on the plot. */
+struct Plotted_series
+{
+    std::vector<double> x;
+    std::vector<double> y;
+};
+
+Range read_x_range(const Series_reader &reader)
+{
+    Range result;
+    reader.for_each([&](const double x, double) { result.add(x); });
+    return result;
+}
+
+/* Reads the series twice at most, with LTTB three times when the x range is
+ * not given, but keeps only the decimated points, so the time of plotting
+ * doesn't depend on the size of the series. */
+Plotted_series decimate(
+        const Series_reader &reader,
+        const Range &x_range,
+        const bool lttb,
+        const int width)
+{
+    std::vector<Point> points;
+    if(lttb)
+    {
+        Lttb_decimator decimator(x_range, width);
+        reader.for_each(
+                [&](const double x, const double y)
+                {
+                    decimator.add_to_average(x, y);
+                });
+        decimator.finish_averages();
+        reader.for_each(
+                [&](const double x, const double y)
+                {
+                    decimator.select(x, y);
+                });
+        points = decimator.points();
+    }
+    else
+    {
+        Min_max_decimator decimator(x_range, width);
+        reader.for_each(
+                [&](const double x, const double y)
+                {
+                    decimator.add(x, y);
+                });
+        points = decimator.points();
+    }
+
+    Plotted_series result;
+    result.x.reserve(points.size());
+    result.y.reserve(points.size());
+    for(const Point &point : points)
+    {
+        result.x.push_back(point.x);
+        result.y.push_back(point.y);
+    }
+    return result;
+}
+
+int main(int argc, const char *argv[]) try
 {
-    const double xmin = -1.0;
-    const double xmax = 1.0;
-    const double ymin = -1.0;
-    const double ymax = 1.0;
+    namespace po = boost::program_options;
 
-    const int n = 100;
-    double x[n], y[n];
-    for(int i = 0; i<100; i++)
+    plstream my_plot;
+    /* PLplot takes its own options, like -dev and -o, out of argv */
+    my_plot.parseopts(&argc, argv, PL_PARSE_SKIP);
+
+    po::options_description description(
+            "Plots series of points read from files, decimated to the width "
+            "of the plot.\n"
+            "Text files have a line \"X Y\" for every point, binary ones "
+            "pairs of native doubles. Options of PLplot are accepted too.\n"
+            "Options");
+    description.add_options()
+        ("help,h", "print help")
+        ("binary", "the files are binary")
+        ("lttb",
+            "decimate with largest triangle three buckets, for series "
+            "sorted by x, instead of keeping minimum and maximum per pixel")
+        ("width",
+            po::value<int>()->default_value(1000),
+            "number of pixel columns, or buckets")
+        ("x-min", po::value<double>(), "start of the x axis")
+        ("x-max", po::value<double>(), "end of the x axis")
+        ("input", po::value<std::vector<std::string>>(), "series files");
+    po::positional_options_description positional;
+    positional.add("input", -1);
+    po::variables_map vm;
+    po::store(
+            po::command_line_parser(argc, argv)
+                .options(description)
+                .positional(positional)
+                .run(),
+            vm);
+    po::notify(vm);
+
+    if(vm.count("help") || !vm.count("input"))
     {
-        x[i] = xmin + i * (xmax - xmin) / n;
-        y[i] = x[i] * x[i] - 0.5;
+        std::cout << description << '\n';
+        return vm.count("help") ? 0 : -1;
     }
+    const int width = vm["width"].as<int>();
+    if(width < 1)
+        throw std::runtime_error("width has to be positive");
+
+    std::vector<Series_reader> readers;
+    for(const std::string &input : vm["input"].as<std::vector<std::string>>())
+        readers.emplace_back(input, vm.count("binary") > 0);
 
+    Range x_range;
+    if(vm.count("x-min") && vm.count("x-max"))
+    {
+        x_range.add(vm["x-min"].as<double>());
+        x_range.add(vm["x-max"].as<double>());
+    }
+    else
     {
-        plstream my_plot;
-        my_plot.parseopts(&argc, argv, PL_PARSE_FULL);
-        my_plot.init();
-        my_plot.env(xmin, xmax, ymin, ymax, 0, 0);
-        my_plot.line(n, x, y);
+        for(const Series_reader &reader : readers)
+        {
+            const Range range = read_x_range(reader);
+            x_range.add(range.min);
+            x_range.add(range.max);
+        }
+        if(vm.count("x-min"))
+            x_range.min = vm["x-min"].as<double>();
+        if(vm.count("x-max"))
+            x_range.max = vm["x-max"].as<double>();
+    }
+    if(x_range.empty())
+        throw std::runtime_error("no points to plot");
+
+    std::vector<Plotted_series> plotted;
+    Range y_range;
+    for(const Series_reader &reader : readers)
+    {
+        plotted.push_back(
+                decimate(reader, x_range, vm.count("lttb") > 0, width));
+        for(const double y : plotted.back().y)
+            y_range.add(y);
+    }
+    if(y_range.empty())
+        throw std::runtime_error("no points in the x range");
+    if(y_range.min == y_range.max)
+    {
+        y_range.min -= 0.5;
+        y_range.max += 0.5;
+    }
+    if(x_range.min == x_range.max)
+    {
+        x_range.min -= 0.5;
+        x_range.max += 0.5;
+    }
+
+    my_plot.init();
+    my_plot.env(x_range.min, x_range.max, y_range.min, y_range.max, 0, 0);
+    for(std::size_t i = 0; i < plotted.size(); ++i)
+    {
+        /* color 0 is the background, 1 the axes */
+        my_plot.col0(2 + i % 14);
+        my_plot.line(
+                static_cast<PLINT>(plotted[i].x.size()),
+                plotted[i].x.data(),
+                plotted[i].y.data());
     }
 
     return 0;
 }
+catch(std::exception &e)
+{
+    std::cerr << "std::exception caught: " << e.what() << '\n';
+    return -1;
+}
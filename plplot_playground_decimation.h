@@ -0,0 +1,392 @@
+/*
+ * SPDX-FileCopyrightText: 2016 Dominik Wójt <domin144@o2.pl>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef PLPLOT_PLAYGROUND_DECIMATION_H
+#define PLPLOT_PLAYGROUND_DECIMATION_H
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+struct Point
+{
+    double x;
+    double y;
+};
+
+/*----------------------------------------------------------------------------*/
+/* Series_reader class.
+ *
+ * Reads a series of points from a file block by block, so the size of the
+ * series is not limited by the memory. Text files have a line "X Y" for every
+ * point, binary files are pairs of doubles in the native byte order. Every
+ * call of for_each is a pass through the whole file. */
+/*----------------------------------------------------------------------------*/
+class Series_reader
+{
+    static constexpr std::size_t block_size = 1 << 20;
+
+    std::string m_path;
+    bool m_binary;
+public:
+    Series_reader(const std::string &path, const bool binary) :
+        m_path(path),
+        m_binary(binary)
+    {
+    }
+
+    const std::string &path() const
+    {
+        return m_path;
+    }
+
+    template<typename Callback>
+    void for_each(Callback &&callback) const
+    {
+        std::ifstream file(m_path, std::ios::binary);
+        if(!file)
+            throw std::runtime_error("failed to open " + m_path);
+        if(m_binary)
+            for_each_binary(file, callback);
+        else
+            for_each_text(file, callback);
+    }
+private:
+    template<typename Callback>
+    void for_each_binary(std::ifstream &file, Callback &callback) const
+    {
+        std::vector<double> buffer(block_size / sizeof(double));
+        while(file)
+        {
+            file.read(
+                    reinterpret_cast<char *>(buffer.data()),
+                    buffer.size() * sizeof(double));
+            const std::size_t count = file.gcount() / (2 * sizeof(double));
+            for(std::size_t i = 0; i < count; ++i)
+                callback(buffer[2 * i], buffer[2 * i + 1]);
+        }
+    }
+
+    /* The part of a line cut by the end of a block is moved to the front of
+     * the buffer and completed by the next read. */
+    template<typename Callback>
+    void for_each_text(std::ifstream &file, Callback &callback) const
+    {
+        std::vector<char> buffer(block_size);
+        std::size_t kept = 0;
+        while(true)
+        {
+            file.read(buffer.data() + kept, block_size - kept);
+            const std::size_t size = kept + file.gcount();
+            const bool last = !file;
+            std::size_t end = size;
+            if(!last)
+            {
+                while(end > 0 && buffer[end - 1] != '\n')
+                    --end;
+                if(end == 0)
+                    throw std::runtime_error("line too long in " + m_path);
+            }
+            const char *position = buffer.data();
+            const char *const parse_end = buffer.data() + end;
+            while(true)
+            {
+                double x;
+                double y;
+                position = skip_space(position, parse_end);
+                if(position == parse_end)
+                    break;
+                auto parsed = std::from_chars(position, parse_end, x);
+                if(parsed.ec != std::errc())
+                    throw std::runtime_error("failed to parse " + m_path);
+                position = skip_space(parsed.ptr, parse_end);
+                parsed = std::from_chars(position, parse_end, y);
+                if(parsed.ec != std::errc())
+                    throw std::runtime_error("missing y in " + m_path);
+                position = parsed.ptr;
+                callback(x, y);
+            }
+
+            if(last)
+                return;
+            kept = size - end;
+            std::memmove(buffer.data(), buffer.data() + end, kept);
+        }
+    }
+
+    static const char *skip_space(const char *position, const char *const end)
+    {
+        while(
+                position != end
+                && (*position == ' ' || *position == '\t'
+                    || *position == '\r' || *position == '\n'))
+        {
+            ++position;
+        }
+        return position;
+    }
+};
+
+struct Range
+{
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+
+    void add(const double value)
+    {
+        min = std::min(min, value);
+        max = std::max(max, value);
+    }
+
+    bool empty() const
+    {
+        return min > max;
+    }
+};
+
+/*----------------------------------------------------------------------------*/
+/* Min_max_decimator class.
+ *
+ * Keeps the first, the last, the lowest and the highest point of every pixel
+ * column. A line through them, in the order of x, covers the same pixels as
+ * the line through all the points of a series sorted by x, so the plot looks
+ * the same with at most 4 points per column. */
+/*----------------------------------------------------------------------------*/
+class Min_max_decimator
+{
+    struct Column
+    {
+        std::size_t count = 0;
+        Point first;
+        Point last;
+        Point min;
+        Point max;
+    };
+
+    double m_x_min;
+    double m_column_scale;
+    std::vector<Column> m_columns;
+public:
+    Min_max_decimator(const Range &x_range, const int width) :
+        m_x_min(x_range.min),
+        m_column_scale(
+            x_range.max > x_range.min
+                ? width / (x_range.max - x_range.min)
+                : 0),
+        m_columns(width)
+    {
+    }
+
+    /* points outside of the x range are dropped */
+    void add(const double x, const double y)
+    {
+        const double position = (x - m_x_min) * m_column_scale;
+        if(
+                !(position >= 0)
+                || position > m_columns.size()
+                || (m_column_scale == 0 && x != m_x_min))
+        {
+            return;
+        }
+        const std::size_t index = std::min<std::size_t>(
+                static_cast<std::size_t>(position),
+                m_columns.size() - 1);
+        Column &column = m_columns[index];
+        const Point point{x, y};
+        if(column.count++ == 0)
+        {
+            column.first = column.last = column.min = column.max = point;
+            return;
+        }
+        column.last = point;
+        if(y < column.min.y)
+            column.min = point;
+        if(y > column.max.y)
+            column.max = point;
+    }
+
+    std::vector<Point> points() const
+    {
+        std::vector<Point> result;
+        result.reserve(4 * m_columns.size());
+        for(const Column &column : m_columns)
+        {
+            if(column.count == 0)
+                continue;
+            Point kept[] = {column.first, column.min, column.max, column.last};
+            std::stable_sort(
+                    std::begin(kept),
+                    std::end(kept),
+                    [](const Point &a, const Point &b) { return a.x < b.x; });
+            for(const Point &point : kept)
+            {
+                if(
+                        result.empty()
+                        || result.back().x != point.x
+                        || result.back().y != point.y)
+                {
+                    result.push_back(point);
+                }
+            }
+        }
+        return result;
+    }
+};
+
+/*----------------------------------------------------------------------------*/
+/* Lttb_decimator class.
+ *
+ * Largest triangle three buckets, with buckets of equal width in x, for
+ * a series sorted by x. It takes two passes: the first one sums the average
+ * point of every bucket, the second one chooses from every bucket the point
+ * making the largest triangle with the point chosen before it and the average
+ * of the next bucket. The first and the last points are always kept. */
+/*----------------------------------------------------------------------------*/
+class Lttb_decimator
+{
+    struct Bucket
+    {
+        std::size_t count = 0;
+        Point sum{0, 0};
+        /* average of the next non-empty bucket */
+        Point next_average;
+        bool has_next = false;
+    };
+
+    double m_x_min;
+    double m_bucket_scale;
+    std::vector<Bucket> m_buckets;
+    std::vector<Point> m_points;
+    std::size_t m_current;
+    Point m_candidate;
+    double m_candidate_area;
+    Point m_last;
+    bool m_any;
+public:
+    Lttb_decimator(const Range &x_range, const int bucket_count) :
+        m_x_min(x_range.min),
+        m_bucket_scale(
+            x_range.max > x_range.min
+                ? bucket_count / (x_range.max - x_range.min)
+                : 0),
+        m_buckets(bucket_count),
+        m_current(0),
+        m_candidate_area(-1),
+        m_any(false)
+    {
+    }
+
+    /* points outside of the x range are dropped, in both passes */
+    void add_to_average(const double x, const double y)
+    {
+        if(!in_range(x))
+            return;
+        Bucket &bucket = m_buckets[bucket_index(x)];
+        ++bucket.count;
+        bucket.sum.x += x;
+        bucket.sum.y += y;
+    }
+
+    /* Call after the first pass, before the second one. */
+    void finish_averages()
+    {
+        bool has_next = false;
+        Point next_average{0, 0};
+        for(std::size_t i = m_buckets.size(); i-- > 0;)
+        {
+            Bucket &bucket = m_buckets[i];
+            bucket.has_next = has_next;
+            bucket.next_average = next_average;
+            if(bucket.count > 0)
+            {
+                has_next = true;
+                next_average = {
+                    bucket.sum.x / bucket.count,
+                    bucket.sum.y / bucket.count};
+            }
+        }
+    }
+
+    void select(const double x, const double y)
+    {
+        if(!in_range(x))
+            return;
+        const Point point{x, y};
+        m_last = point;
+        if(!m_any)
+        {
+            m_any = true;
+            m_points.push_back(point);
+            m_current = bucket_index(x);
+            return;
+        }
+        const std::size_t index = bucket_index(x);
+        if(index != m_current)
+        {
+            choose_candidate();
+            m_current = index;
+        }
+        const Bucket &bucket = m_buckets[m_current];
+        if(!bucket.has_next)
+            return;
+        const Point &a = m_points.back();
+        const Point &c = bucket.next_average;
+        const double area = std::abs(
+                (a.x - c.x) * (point.y - a.y) - (a.x - point.x) * (c.y - a.y));
+        if(area > m_candidate_area)
+        {
+            m_candidate = point;
+            m_candidate_area = area;
+        }
+    }
+
+    /* Call after the second pass. */
+    std::vector<Point> points()
+    {
+        choose_candidate();
+        if(
+                m_any
+                && (m_points.back().x != m_last.x
+                    || m_points.back().y != m_last.y))
+        {
+            m_points.push_back(m_last);
+        }
+        return m_points;
+    }
+private:
+    bool in_range(const double x) const
+    {
+        const double position = (x - m_x_min) * m_bucket_scale;
+        return position >= 0
+                && position <= m_buckets.size()
+                && (m_bucket_scale > 0 || x == m_x_min);
+    }
+
+    std::size_t bucket_index(const double x) const
+    {
+        const double position = (x - m_x_min) * m_bucket_scale;
+        return std::min<std::size_t>(
+                static_cast<std::size_t>(position),
+                m_buckets.size() - 1);
+    }
+
+    void choose_candidate()
+    {
+        if(m_candidate_area >= 0)
+            m_points.push_back(m_candidate);
+        m_candidate_area = -1;
+    }
+};
+
+#endif /* PLPLOT_PLAYGROUND_DECIMATION_H */
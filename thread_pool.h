@@ -0,0 +1,139 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Dominik Wójt <domin144@o2.pl>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*----------------------------------------------------------------------------*/
+/* Thread_pool class.
+ *
+ * Fixed set of worker threads executing batches of indexed tasks. The thread
+ * calling run takes part in the work, so a pool of thread_count threads starts
+ * thread_count - 1 workers.
+ *
+ * Only one batch runs at a time. The first exception thrown by a task is
+ * rethrown from run once all the tasks of the batch are finished. */
+/*----------------------------------------------------------------------------*/
+class Thread_pool
+{
+public:
+    using Task = std::function<void(int)>;
+
+private:
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_work_ready;
+    std::condition_variable m_work_done;
+    const Task *m_task = nullptr;
+    int m_task_count = 0;
+    int m_next_task = 0;
+    int m_finished_tasks = 0;
+    std::exception_ptr m_exception;
+    bool m_stop = false;
+
+public:
+    Thread_pool(const int thread_count)
+    {
+        const int worker_count = std::max(thread_count, 1) - 1;
+        m_workers.reserve(worker_count);
+        for(int i = 0; i < worker_count; ++i)
+            m_workers.emplace_back([this]() { work(); });
+    }
+
+    Thread_pool(const Thread_pool &) = delete;
+
+    Thread_pool &operator=(const Thread_pool &) = delete;
+
+    ~Thread_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_work_ready.notify_all();
+        for(std::thread &worker : m_workers)
+            worker.join();
+    }
+
+    int get_thread_count() const
+    {
+        return m_workers.size() + 1;
+    }
+
+    /* Calls task(i) for every i in [0, task_count) and waits for all of them
+     * to finish. */
+    void run(const int task_count, const Task &task)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_task = &task;
+        m_task_count = task_count;
+        m_next_task = 0;
+        m_finished_tasks = 0;
+        m_exception = nullptr;
+        m_work_ready.notify_all();
+
+        run_tasks(lock);
+        m_work_done.wait(
+                lock,
+                [this]() { return m_finished_tasks == m_task_count; });
+
+        m_task = nullptr;
+        m_task_count = 0;
+        m_next_task = 0;
+        if(m_exception)
+            std::rethrow_exception(m_exception);
+    }
+
+private:
+    void work()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while(true)
+        {
+            m_work_ready.wait(
+                    lock,
+                    [this]() { return m_stop || m_next_task < m_task_count; });
+            if(m_stop)
+                return;
+            run_tasks(lock);
+        }
+    }
+
+    void run_tasks(std::unique_lock<std::mutex> &lock)
+    {
+        while(m_next_task < m_task_count)
+        {
+            const int index = m_next_task++;
+            const Task &task = *m_task;
+            lock.unlock();
+            std::exception_ptr exception;
+            try
+            {
+                task(index);
+            }
+            catch(...)
+            {
+                exception = std::current_exception();
+            }
+            lock.lock();
+            if(exception && !m_exception)
+                m_exception = exception;
+            if(++m_finished_tasks == m_task_count)
+                m_work_done.notify_all();
+        }
+    }
+};
+/*----------------------------------------------------------------------------*/
+
+#endif /* THREAD_POOL_H */
@@ -167,7 +167,7 @@ public:
 
     Value pop()
     {
-        my_assert(get_size() > 0, "poping empty heap");
+        my_debug_assert(get_size() > 0, "poping empty heap");
         my_pop_heap(m_array.begin(), m_array.end(), m_compare);
         Value result = m_array.back();
         m_array.pop_back();
@@ -4,10 +4,24 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#include "update_dir_copy.h"
+#include "update_dir_delta.h"
+#include "update_dir_hash.h"
+#include "update_dir_index.h"
+#include "update_dir_journal.h"
+#include "update_dir_scan.h"
+#include "update_dir_watch.h"
+
+#include <algorithm>
 #include <boost/program_options.hpp>
+#include <chrono>
 #include <exception>
+#include <fcntl.h>
 #include <filesystem>
 #include <iostream>
+#include <sys/stat.h>
+#include <thread>
+#include <unordered_map>
 
 struct just_exit : std::exception
 {
@@ -20,6 +34,11 @@ struct options
 	std::string source_directory;
 	std::string target_directory;
 	bool dry_run;
+	unsigned threads;
+	hash_algorithm hash;
+	bool watch;
+	unsigned debounce_ms;
+	bool journaled;
 };
 
 options parse_options(const int argc, const char* const argv[])
@@ -29,7 +48,21 @@ options parse_options(const int argc, const char* const argv[])
 		("help", "show help") //
 		("source-dir", po::value<std::string>(), "source directory") //
 		("target-dir", po::value<std::string>(), "target directory") //
-		("dry-run", "don't make the changes, just list them");
+		("dry-run", "don't make the changes, just list them") //
+		("threads",
+		 po::value<unsigned>()->default_value(
+			 std::max(std::thread::hardware_concurrency(), 1u)),
+		 "number of threads scanning the directories and copying files") //
+		("hash",
+		 po::value<std::string>()->default_value("lanes"),
+		 "content hash, lanes or murmur3") //
+		("watch", "after the first sync, keep syncing changes of the source") //
+		("debounce",
+		 po::value<unsigned>()->default_value(200),
+		 "milliseconds without source changes before they are synced") //
+		("journaled",
+		 "apply changes through a journal, so an interrupted sync is "
+		 "completed or rolled back on the next run");
 
 	po::positional_options_description positional_description;
 	positional_description.add("source-dir", 1);
@@ -62,9 +95,533 @@ options parse_options(const int argc, const char* const argv[])
 	result.source_directory = vm["source-dir"].as<std::string>();
 	result.target_directory = vm["target-dir"].as<std::string>();
 	result.dry_run = vm.count("dry-run");
+	result.threads = vm["threads"].as<unsigned>();
+	result.hash = parse_hash_algorithm(vm["hash"].as<std::string>());
+	result.watch = vm.count("watch");
+	result.debounce_ms = vm["debounce"].as<unsigned>();
+	result.journaled = vm.count("journaled");
+	return result;
+}
+
+const char* to_string(const change_kind kind)
+{
+	switch (kind)
+	{
+	case change_kind::added:
+		return "added";
+	case change_kind::removed:
+		return "removed";
+	case change_kind::modified:
+		return "modified";
+	case change_kind::touched:
+		return "touched";
+	}
+	return "unknown";
+}
+
+/* Content hashes of the source files, in the order of the source index. Files
+ * whose size, mtime and inode match the metadata index take the hash from it,
+ * the others were hashed by the pipeline. */
+std::vector<hash_128> collect_source_hashes(
+	const directory_index& source,
+	const metadata_index& metadata,
+	const std::unordered_map<std::string, hash_128>& computed)
+{
+	std::vector<hash_128> result(source.entries().size());
+	for (std::size_t i = 0; i < source.entries().size(); ++i)
+	{
+		const index_entry& entry = source.entries()[i];
+		if (entry.type != entry_type::file)
+			continue;
+		const std::string path{source.path(entry)};
+		const metadata_record* const record = metadata.find(path);
+		if (record && record->matches(entry.size, entry.mtime_ns, entry.inode))
+		{
+			result[i] = record->hash;
+			continue;
+		}
+		const auto found = computed.find(path);
+		if (found == computed.end())
+			throw std::runtime_error{"missing hash of " + path};
+		result[i] = found->second;
+	}
+	return result;
+}
+
+/* A modified file can turn out to be only touched, if the target still holds
+ * the content recorded in the metadata index and the source has the same
+ * size. The source hash decides then. */
+bool is_touch_candidate(
+	const change& change_0,
+	const directory_index& source,
+	const directory_index& target,
+	const metadata_index& metadata)
+{
+	if (change_0.kind != change_kind::modified
+		|| change_0.type != entry_type::file)
+		return false;
+	const index_entry* const source_entry = source.find(change_0.path);
+	const index_entry* const target_entry = target.find(change_0.path);
+	const metadata_record* const record = metadata.find(change_0.path);
+	if (!source_entry || !target_entry || !record
+		|| target_entry->type != entry_type::file)
+		return false;
+	return target_entry->size == record->size
+		&& target_entry->mtime_ns == record->mtime_ns
+		&& source_entry->size == record->size;
+}
+
+void mark_touched(
+	std::vector<change>& candidates,
+	const directory_index& source,
+	const std::vector<hash_128>& source_hashes,
+	const metadata_index& metadata)
+{
+	for (change& change_0 : candidates)
+	{
+		const index_entry* const source_entry = source.find(change_0.path);
+		const metadata_record* const record = metadata.find(change_0.path);
+		const hash_128& source_hash =
+			source_hashes[source_entry - source.entries().data()];
+		if (source_hash == record->hash)
+			change_0.kind = change_kind::touched;
+	}
+}
+
+void write_metadata_index(
+	const std::filesystem::path& target_root,
+	const directory_index& source,
+	const std::vector<hash_128>& source_hashes,
+	const hash_algorithm algorithm)
+{
+	metadata_index_builder builder;
+	for (std::size_t i = 0; i < source.entries().size(); ++i)
+	{
+		const index_entry& entry = source.entries()[i];
+		if (entry.type != entry_type::file)
+			continue;
+		builder.add(
+			source.path(entry),
+			entry.size,
+			entry.mtime_ns,
+			entry.inode,
+			source_hashes[i]);
+	}
+	builder.write(target_root / metadata_index_name, algorithm);
+}
+
+void copy_mtime(
+	const std::filesystem::path& source,
+	const std::filesystem::path& target)
+{
+	struct stat status;
+	if (::lstat(source.c_str(), &status) != 0)
+		throw std::system_error(
+			errno,
+			std::generic_category(),
+			"failed to stat " + source.string());
+	const struct timespec times[2] = {status.st_atim, status.st_mtim};
+	if (::utimensat(AT_FDCWD, target.c_str(), times, AT_SYMLINK_NOFOLLOW)
+		!= 0)
+		throw std::system_error(
+			errno,
+			std::generic_category(),
+			"failed to set times of " + target.string());
+}
+
+void apply_direct(
+	const options& options_0,
+	const std::vector<change>& changes,
+	copy_engine& copier,
+	delta_statistics& statistics)
+{
+	namespace fs = std::filesystem;
+	const fs::path source_root = options_0.source_directory;
+	const fs::path target_root = options_0.target_directory;
+	fs::create_directories(target_root);
+	for (const change& change_0 : changes)
+	{
+		const fs::path source = source_root / change_0.path;
+		const fs::path target = target_root / change_0.path;
+		if (change_0.kind == change_kind::removed)
+		{
+			fs::remove_all(target);
+			continue;
+		}
+		if (change_0.kind == change_kind::touched)
+		{
+			copy_mtime(source, target);
+			continue;
+		}
+
+		/* only a file can be overwritten in place and only a directory can be
+		 * kept, anything else is replaced */
+		const fs::file_status target_status = fs::symlink_status(target);
+		const bool keep_target = (change_0.type == entry_type::file
+								  && fs::is_regular_file(target_status))
+			|| (change_0.type == entry_type::directory
+				&& fs::is_directory(target_status));
+		if (!keep_target)
+			fs::remove_all(target);
+
+		switch (change_0.type)
+		{
+		case entry_type::directory:
+			fs::create_directory(target);
+			break;
+		case entry_type::file:
+		{
+			const std::uint64_t size = fs::file_size(source);
+			if (keep_target && size >= delta_update_threshold)
+			{
+				update_file_in_place(source, target, statistics);
+				copy_mtime(source, target);
+			}
+			else
+			{
+				copier.add(source, target);
+				statistics.bytes_scanned += size;
+				statistics.bytes_written += size;
+			}
+			break;
+		}
+		case entry_type::symlink:
+			fs::copy_symlink(source, target);
+			break;
+		case entry_type::other:
+			std::cerr << "skipping special file " << source << '\n';
+			break;
+		}
+	}
+	copier.finish();
+}
+
+/* Staged files are committed in batches, which bounds the space taken by
+ * files waiting for the rename. */
+constexpr std::size_t journal_batch_files = 4096;
+constexpr std::uint64_t journal_batch_bytes = std::uint64_t{1} << 30;
+
+/* Like apply_direct, but every file and symlink is written to a staging path
+ * and renamed into place when its batch is committed to the journal. Large
+ * modified files are staged as a copy of the target, a reflink where the file
+ * system can, updated with the changed chunks. */
+void apply_journaled(
+	const options& options_0,
+	const std::vector<change>& changes,
+	copy_engine& copier,
+	delta_statistics& statistics)
+{
+	namespace fs = std::filesystem;
+	const fs::path source_root = options_0.source_directory;
+	const fs::path target_root = options_0.target_directory;
+	/* no journal and no flushes for nothing */
+	if (changes.empty())
+		return;
+	fs::create_directories(target_root);
+	journal journal_0{target_root};
+	std::size_t staged_files = 0;
+	std::uint64_t staged_bytes = 0;
+	auto commit = [&]
+	{
+		copier.finish();
+		journal_0.commit();
+		staged_files = 0;
+		staged_bytes = 0;
+	};
+	for (const change& change_0 : changes)
+	{
+		const fs::path source = source_root / change_0.path;
+		const fs::path target = target_root / change_0.path;
+		if (change_0.kind == change_kind::removed)
+		{
+			journal_0.add(journal_operation::remove, change_0.path);
+			continue;
+		}
+		if (change_0.kind == change_kind::touched)
+		{
+			copy_mtime(source, target);
+			continue;
+		}
+
+		/* a rename replaces anything but a directory */
+		const fs::file_status target_status = fs::symlink_status(target);
+		if (change_0.type == entry_type::directory)
+		{
+			if (fs::is_directory(target_status))
+				continue;
+			/* the directory is needed before its contents are staged */
+			if (fs::exists(target_status))
+			{
+				journal_0.add(journal_operation::remove, change_0.path);
+				commit();
+			}
+			fs::create_directory(target);
+			journal_0.add(journal_operation::create_directory, change_0.path);
+			continue;
+		}
+		if (fs::is_directory(target_status))
+			journal_0.add(journal_operation::remove, change_0.path);
+
+		const fs::path staging = staging_path(target);
+		switch (change_0.type)
+		{
+		case entry_type::file:
+		{
+			const std::uint64_t size = fs::file_size(source);
+			if (fs::is_regular_file(target_status)
+				&& size >= delta_update_threshold)
+			{
+				statistics.bytes_written += copier.copy_file(target, staging);
+				update_file_in_place(source, staging, statistics);
+				copy_mtime(source, staging);
+			}
+			else
+			{
+				copier.add(source, staging);
+				statistics.bytes_scanned += size;
+				statistics.bytes_written += size;
+			}
+			staged_bytes += size;
+			break;
+		}
+		case entry_type::symlink:
+			fs::remove(staging);
+			fs::create_symlink(fs::read_symlink(source), staging);
+			break;
+		default:
+			std::cerr << "skipping special file " << source << '\n';
+			continue;
+		}
+		journal_0.add(journal_operation::stage, change_0.path);
+		++staged_files;
+		if (staged_files >= journal_batch_files
+			|| staged_bytes >= journal_batch_bytes)
+			commit();
+	}
+	commit();
+	journal_0.finish();
+	statistics.journal_batches += journal_0.commit_count();
+}
+
+void apply(
+	const options& options_0,
+	const std::vector<change>& changes,
+	copy_engine& copier,
+	delta_statistics& statistics)
+{
+	if (options_0.journaled)
+		apply_journaled(options_0, changes, copier, statistics);
+	else
+		apply_direct(options_0, changes, copier, statistics);
+}
+
+/* The index and journal files in the target have no counterpart in the
+ * source. */
+void remove_index_changes(std::vector<change>& changes)
+{
+	const std::string index_name = metadata_index_name;
+	changes.erase(
+		std::remove_if(
+			changes.begin(),
+			changes.end(),
+			[&](const change& change_0)
+			{
+				return change_0.path == index_name
+					|| change_0.path == index_name + ".tmp"
+					|| change_0.path == journal_name;
+			}),
+		changes.end());
+}
+
+/* Full sync of the whole tree. */
+void sync(const options& options_0)
+{
+	using clock = std::chrono::steady_clock;
+	const std::filesystem::path source_root = options_0.source_directory;
+	const std::filesystem::path target_root = options_0.target_directory;
+	const metadata_index metadata{
+		target_root / metadata_index_name,
+		options_0.hash};
+
+	/* Source files not matching the metadata index are hashed while the scan
+	 * goes on, and the hashing continues while the first changes are
+	 * applied. */
+	hash_pipeline hasher{options_0.hash, options_0.threads, 1024};
+	tree_scanner scanner{options_0.threads};
+	scanner.set_entry_callback(
+		[&](const std::size_t tree,
+			const std::string_view path,
+			const struct stat& status)
+		{
+			if (tree != 0 || !S_ISREG(status.st_mode))
+				return;
+			const metadata_record* const record = metadata.find(path);
+			const std::int64_t mtime_ns =
+				std::int64_t{status.st_mtim.tv_sec} * 1000000000
+				+ status.st_mtim.tv_nsec;
+			if (record
+				&& record->matches(status.st_size, mtime_ns, status.st_ino))
+				return;
+			hasher.add(std::string{path}, source_root / path, status.st_size);
+		});
+
+	const clock::time_point scan_start = clock::now();
+	const std::vector<directory_index> indexes =
+		scanner.scan({source_root, target_root});
+	const std::chrono::duration<double> scan_time =
+		clock::now() - scan_start;
+	const std::size_t scanned =
+		indexes[0].entries().size() + indexes[1].entries().size();
+	std::cerr << "scanned " << scanned << " entries in " << scan_time.count()
+			  << " s, " << scanned / scan_time.count() << " entries/s\n";
+
+	std::vector<change> changes = diff(indexes[0], indexes[1]);
+	remove_index_changes(changes);
+
+	/* only possibly touched files have to wait for the hashes */
+	std::vector<change> touch_candidates;
+	std::vector<change> other_changes;
+	for (change& change_0 : changes)
+	{
+		if (is_touch_candidate(change_0, indexes[0], indexes[1], metadata))
+			touch_candidates.push_back(std::move(change_0));
+		else
+			other_changes.push_back(std::move(change_0));
+	}
+
+	delta_statistics statistics;
+	copy_engine copier{options_0.threads};
+	const clock::time_point apply_start = clock::now();
+	for (const change& change_0 : other_changes)
+		std::cout << to_string(change_0.kind) << ' ' << change_0.path << '\n';
+	if (!options_0.dry_run)
+		apply(options_0, other_changes, copier, statistics);
+
+	const clock::time_point hash_wait_start = clock::now();
+	const std::vector<hash_128> source_hashes =
+		collect_source_hashes(indexes[0], metadata, hasher.finish());
+	const std::chrono::duration<double> hash_wait_time =
+		clock::now() - hash_wait_start;
+	std::cerr << "hashed " << hasher.queued_files() << " files, "
+			  << hasher.queued_bytes() << " bytes, waited "
+			  << hash_wait_time.count() << " s for hashing to finish\n";
+
+	mark_touched(touch_candidates, indexes[0], source_hashes, metadata);
+	for (const change& change_0 : touch_candidates)
+		std::cout << to_string(change_0.kind) << ' ' << change_0.path << '\n';
+
+	if (!options_0.dry_run)
+	{
+		apply(options_0, touch_candidates, copier, statistics);
+		const std::chrono::duration<double> apply_time =
+			clock::now() - apply_start;
+		const copy_statistics& copied = copier.statistics();
+		std::cerr << "copied " << copied.files << " files, " << copied.bytes
+				  << " bytes in " << apply_time.count() << " s, "
+				  << copied.files / apply_time.count() << " files/s, "
+				  << copied.bytes / apply_time.count() / 1e6 << " MB/s"
+				  << " (reflink " << copied.reflinks << ", copy_file_range "
+				  << copied.copy_file_ranges << ", sendfile "
+				  << copied.sendfiles << ")\n";
+		std::cerr << "scanned " << statistics.bytes_scanned
+				  << " bytes, wrote " << statistics.bytes_written << " bytes";
+		if (options_0.journaled)
+			std::cerr << " in " << statistics.journal_batches
+					  << " journal batches";
+		std::cerr << '\n';
+		write_metadata_index(
+			target_root,
+			indexes[0],
+			source_hashes,
+			options_0.hash);
+	}
+}
+
+/* Index of a single entry, and with a recursive path also of its subtree. An
+ * empty path stands for the root, which itself has no entry. */
+directory_index scan_path(
+	tree_scanner& scanner,
+	const std::filesystem::path& root,
+	const dirty_path& dirty)
+{
+	directory_index result;
+	const std::filesystem::path path = root / dirty.relative_path;
+	if (!dirty.relative_path.empty())
+	{
+		struct stat status;
+		if (::lstat(path.c_str(), &status) != 0)
+		{
+			if (errno == ENOENT || errno == ENOTDIR)
+				return result;
+			throw std::system_error(
+				errno,
+				std::generic_category(),
+				"failed to stat " + path.string());
+		}
+		const std::string link_target = S_ISLNK(status.st_mode)
+			? std::filesystem::read_symlink(path).string()
+			: std::string{};
+		result.add(dirty.relative_path, status, link_target);
+		if (!dirty.recursive || !S_ISDIR(status.st_mode))
+			return result;
+	}
+	else if (!dirty.recursive)
+		return result;
+
+	const std::string prefix =
+		dirty.relative_path.empty() ? std::string{} : dirty.relative_path + '/';
+	result.append(scanner.scan({path})[0], prefix);
+	result.sort();
 	return result;
 }
 
+/* Syncs changes of the source as they come. Each burst of events is synced
+ * by comparing only the affected paths, the metadata index is left as written
+ * by the full sync and just leads to rehashing of the changed files on the
+ * next full sync. The watches are set before the first sync, so changes made
+ * during it aren't missed. */
+void watch(const options& options_0)
+{
+	using clock = std::chrono::steady_clock;
+	const std::filesystem::path source_root = options_0.source_directory;
+	const std::filesystem::path target_root = options_0.target_directory;
+	directory_watcher watcher{source_root};
+	sync(options_0);
+
+	const std::chrono::milliseconds debounce{options_0.debounce_ms};
+	tree_scanner scanner{options_0.threads};
+	copy_engine copier{options_0.threads};
+	std::cerr << "watching " << source_root << '\n';
+	while (true)
+	{
+		const std::vector<dirty_path> dirty_paths =
+			watcher.wait(debounce, 10 * debounce);
+		const clock::time_point sync_start = clock::now();
+		delta_statistics statistics;
+		std::size_t change_count = 0;
+		for (const dirty_path& dirty : dirty_paths)
+		{
+			if (dirty.relative_path.empty())
+				std::cerr << "event queue overflow, rescanning\n";
+			std::vector<change> changes = diff(
+				scan_path(scanner, source_root, dirty),
+				scan_path(scanner, target_root, dirty));
+			remove_index_changes(changes);
+			for (const change& change_0 : changes)
+				std::cout << to_string(change_0.kind) << ' ' << change_0.path
+						  << '\n';
+			change_count += changes.size();
+			if (!options_0.dry_run)
+				apply(options_0, changes, copier, statistics);
+		}
+		const std::chrono::duration<double> sync_time =
+			clock::now() - sync_start;
+		std::cerr << "synced " << dirty_paths.size() << " paths, "
+				  << change_count << " changes in " << sync_time.count()
+				  << " s\n";
+	}
+}
+
 int main(const int argc, const char* const argv[])
 try
 {
@@ -77,6 +634,21 @@ try
 		std::cout << "dry run" << '\n';
 	}
 
+	if (!options_0.dry_run)
+	{
+		const recovery_statistics recovered =
+			recover_journal(options_0.target_directory);
+		if (recovered.replayed != 0 || recovered.rolled_back != 0)
+			std::cerr << "recovered interrupted sync, replayed "
+					  << recovered.replayed << ", rolled back "
+					  << recovered.rolled_back << " operations\n";
+	}
+
+	if (options_0.watch)
+		watch(options_0);
+	else
+		sync(options_0);
+
 	return 0;
 }
 catch (just_exit&)
@@ -0,0 +1,269 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Dominik Wójt <domin144@o2.pl>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef UPDATE_DIR_COPY_H
+#define UPDATE_DIR_COPY_H
+
+#include "thread_pool.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <fcntl.h>
+#include <filesystem>
+#include <linux/fs.h>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+#include <vector>
+
+enum class copy_method
+{
+	reflink,
+	copy_file_range,
+	sendfile
+};
+
+struct copy_statistics
+{
+	std::atomic<std::uint64_t> files{0};
+	std::atomic<std::uint64_t> bytes{0};
+	std::atomic<std::uint64_t> reflinks{0};
+	std::atomic<std::uint64_t> copy_file_ranges{0};
+	std::atomic<std::uint64_t> sendfiles{0};
+};
+
+/* Copies files without passing the data through user space. A reflink shares
+ * the extents and copies nothing, copy_file_range lets the kernel or the file
+ * system copy, sendfile is the fallback working everywhere. A method failing
+ * for a single file, like across devices, is skipped for that file only. Once
+ * it fails as unsupported by the kernel or the file system, it isn't tried
+ * again.
+ *
+ * Copies are queued and run in batches on a bounded pool of threads, so
+ * latency of the syscalls of many small files overlaps. */
+class copy_engine
+{
+public:
+	copy_engine(const unsigned thread_count) :
+		m_pool{static_cast<int>(thread_count)}
+	{
+	}
+
+	/* The target is created or truncated. Its parent directory has to exist by
+	 * the time finish is called. */
+	void add(std::filesystem::path source, std::filesystem::path target)
+	{
+		m_jobs.push_back({std::move(source), std::move(target)});
+	}
+
+	/* Runs all queued copies, rethrows the first error. */
+	void finish()
+	{
+		m_pool.run(
+			m_jobs.size(),
+			[this](const int i)
+			{ copy_file(m_jobs[i].source, m_jobs[i].target); });
+		m_jobs.clear();
+	}
+
+	const copy_statistics& statistics() const
+	{
+		return m_statistics;
+	}
+
+	/* Copies content, mode and times of a regular file. Returns the bytes
+	 * written, none for a reflink. */
+	std::uint64_t copy_file(
+		const std::filesystem::path& source,
+		const std::filesystem::path& target)
+	{
+		const file_descriptor input{source, O_RDONLY, 0};
+		struct stat status;
+		if (::fstat(input.get(), &status) != 0)
+			throw std::system_error(
+				errno,
+				std::generic_category(),
+				"failed to stat " + source.string());
+		const file_descriptor output{
+			target,
+			O_WRONLY | O_CREAT | O_TRUNC,
+			status.st_mode & 07777};
+
+		const copy_method method =
+			copy_content(input.get(), output.get(), status.st_size);
+		switch (method)
+		{
+		case copy_method::reflink:
+			++m_statistics.reflinks;
+			break;
+		case copy_method::copy_file_range:
+			++m_statistics.copy_file_ranges;
+			break;
+		case copy_method::sendfile:
+			++m_statistics.sendfiles;
+			break;
+		}
+		++m_statistics.files;
+		m_statistics.bytes += status.st_size;
+
+		if (::fchmod(output.get(), status.st_mode & 07777) != 0)
+			throw std::system_error(
+				errno,
+				std::generic_category(),
+				"failed to set mode of " + target.string());
+		const struct timespec times[2] = {status.st_atim, status.st_mtim};
+		if (::futimens(output.get(), times) != 0)
+			throw std::system_error(
+				errno,
+				std::generic_category(),
+				"failed to set times of " + target.string());
+		return method == copy_method::reflink ? 0 : status.st_size;
+	}
+
+private:
+	class file_descriptor
+	{
+	public:
+		file_descriptor(
+			const std::filesystem::path& path,
+			const int flags,
+			const mode_t mode) :
+			m_descriptor{::open(path.c_str(), flags | O_CLOEXEC, mode)}
+		{
+			if (m_descriptor < 0)
+				throw std::system_error(
+					errno,
+					std::generic_category(),
+					"failed to open " + path.string());
+		}
+
+		file_descriptor(const file_descriptor&) = delete;
+
+		file_descriptor& operator=(const file_descriptor&) = delete;
+
+		~file_descriptor()
+		{
+			::close(m_descriptor);
+		}
+
+		int get() const
+		{
+			return m_descriptor;
+		}
+
+	private:
+		int m_descriptor;
+	};
+
+	struct job
+	{
+		std::filesystem::path source;
+		std::filesystem::path target;
+	};
+
+	/* The method doesn't work on this file system or kernel, so it isn't
+	 * tried again. */
+	static bool is_unsupported(const int error)
+	{
+		return error == EOPNOTSUPP || error == ENOSYS;
+	}
+
+	/* The method doesn't work for this file, like across devices or on
+	 * a file it isn't permitted for, but may work for others. */
+	static bool is_unsupported_for_file(const int error)
+	{
+		return is_unsupported(error) || error == ENOTTY || error == EINVAL
+			|| error == EXDEV || error == EPERM;
+	}
+
+	copy_method copy_content(
+		const int input,
+		const int output,
+		const std::uint64_t size)
+	{
+		if (m_try_reflink)
+		{
+			if (::ioctl(output, FICLONE, input) == 0)
+				return copy_method::reflink;
+			if (!is_unsupported_for_file(errno))
+				throw std::system_error(
+					errno,
+					std::generic_category(),
+					"failed to clone");
+			if (is_unsupported(errno))
+				m_try_reflink = false;
+		}
+
+		std::uint64_t copied = 0;
+		bool fall_back = !m_try_copy_file_range;
+		if (!fall_back)
+		{
+			while (copied < size)
+			{
+				const ssize_t result = ::copy_file_range(
+					input,
+					nullptr,
+					output,
+					nullptr,
+					size - copied,
+					0);
+				if (result < 0)
+				{
+					if (errno == EINTR)
+						continue;
+					if (copied == 0 && is_unsupported_for_file(errno))
+					{
+						if (is_unsupported(errno))
+							m_try_copy_file_range = false;
+						fall_back = true;
+						break;
+					}
+					throw std::system_error(
+						errno,
+						std::generic_category(),
+						"failed to copy_file_range");
+				}
+				/* the source shrank in the meantime */
+				if (result == 0)
+					return copy_method::copy_file_range;
+				copied += result;
+			}
+			if (!fall_back)
+				return copy_method::copy_file_range;
+		}
+
+		while (copied < size)
+		{
+			const ssize_t result =
+				::sendfile(output, input, nullptr, size - copied);
+			if (result < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				throw std::system_error(
+					errno,
+					std::generic_category(),
+					"failed to sendfile");
+			}
+			if (result == 0)
+				break;
+			copied += result;
+		}
+		return copy_method::sendfile;
+	}
+
+	Thread_pool m_pool;
+	std::vector<job> m_jobs;
+	copy_statistics m_statistics;
+	std::atomic<bool> m_try_reflink{true};
+	std::atomic<bool> m_try_copy_file_range{true};
+};
+
+#endif /* UPDATE_DIR_COPY_H */
@@ -0,0 +1,396 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Dominik Wójt <domin144@o2.pl>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef UPDATE_DIR_DELTA_H
+#define UPDATE_DIR_DELTA_H
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+#include <vector>
+
+/* Files at least this big are updated in place by delta, smaller ones are just
+ * copied. */
+constexpr std::uint64_t delta_update_threshold = 1 << 20;
+
+struct hash_128
+{
+	std::uint64_t low;
+	std::uint64_t high;
+
+	bool operator==(const hash_128& other) const
+	{
+		return low == other.low && high == other.high;
+	}
+
+	bool operator!=(const hash_128& other) const
+	{
+		return !(*this == other);
+	}
+};
+
+inline std::uint64_t rotate_left(const std::uint64_t x, const int bits)
+{
+	return (x << bits) | (x >> (64 - bits));
+}
+
+inline std::uint64_t mix_64(std::uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdull;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ull;
+	x ^= x >> 33;
+	return x;
+}
+
+/* MurmurHash3 x64 128 bit variant, strong enough to tell chunks apart. */
+inline hash_128 hash_chunk(
+	const unsigned char* const data,
+	const std::size_t size)
+{
+	constexpr std::uint64_t c1 = 0x87c37b91114253d5ull;
+	constexpr std::uint64_t c2 = 0x4cf5ad432745937full;
+	std::uint64_t h1 = 0;
+	std::uint64_t h2 = 0;
+
+	const std::size_t block_count = size / 16;
+	for (std::size_t i = 0; i < block_count; ++i)
+	{
+		std::uint64_t k1;
+		std::uint64_t k2;
+		std::memcpy(&k1, data + i * 16, 8);
+		std::memcpy(&k2, data + i * 16 + 8, 8);
+
+		k1 *= c1;
+		k1 = rotate_left(k1, 31);
+		k1 *= c2;
+		h1 ^= k1;
+		h1 = rotate_left(h1, 27);
+		h1 += h2;
+		h1 = h1 * 5 + 0x52dce729;
+
+		k2 *= c2;
+		k2 = rotate_left(k2, 33);
+		k2 *= c1;
+		h2 ^= k2;
+		h2 = rotate_left(h2, 31);
+		h2 += h1;
+		h2 = h2 * 5 + 0x38495ab5;
+	}
+
+	const unsigned char* const tail = data + block_count * 16;
+	std::uint64_t k1 = 0;
+	std::uint64_t k2 = 0;
+	switch (size & 15)
+	{
+	case 15: k2 ^= std::uint64_t{tail[14]} << 48; [[fallthrough]];
+	case 14: k2 ^= std::uint64_t{tail[13]} << 40; [[fallthrough]];
+	case 13: k2 ^= std::uint64_t{tail[12]} << 32; [[fallthrough]];
+	case 12: k2 ^= std::uint64_t{tail[11]} << 24; [[fallthrough]];
+	case 11: k2 ^= std::uint64_t{tail[10]} << 16; [[fallthrough]];
+	case 10: k2 ^= std::uint64_t{tail[9]} << 8; [[fallthrough]];
+	case 9:
+		k2 ^= std::uint64_t{tail[8]};
+		k2 *= c2;
+		k2 = rotate_left(k2, 33);
+		k2 *= c1;
+		h2 ^= k2;
+		[[fallthrough]];
+	case 8: k1 ^= std::uint64_t{tail[7]} << 56; [[fallthrough]];
+	case 7: k1 ^= std::uint64_t{tail[6]} << 48; [[fallthrough]];
+	case 6: k1 ^= std::uint64_t{tail[5]} << 40; [[fallthrough]];
+	case 5: k1 ^= std::uint64_t{tail[4]} << 32; [[fallthrough]];
+	case 4: k1 ^= std::uint64_t{tail[3]} << 24; [[fallthrough]];
+	case 3: k1 ^= std::uint64_t{tail[2]} << 16; [[fallthrough]];
+	case 2: k1 ^= std::uint64_t{tail[1]} << 8; [[fallthrough]];
+	case 1:
+		k1 ^= std::uint64_t{tail[0]};
+		k1 *= c1;
+		k1 = rotate_left(k1, 31);
+		k1 *= c2;
+		h1 ^= k1;
+	}
+
+	h1 ^= size;
+	h2 ^= size;
+	h1 += h2;
+	h2 += h1;
+	h1 = mix_64(h1);
+	h2 = mix_64(h2);
+	h1 += h2;
+	h2 += h1;
+	return {h1, h2};
+}
+
+/* Random table of the Gear rolling hash, generated with splitmix64. */
+constexpr std::array<std::uint64_t, 256> make_gear_table()
+{
+	std::array<std::uint64_t, 256> table{};
+	std::uint64_t state = 0x9e3779b97f4a7c15ull;
+	for (std::uint64_t& value : table)
+	{
+		state += 0x9e3779b97f4a7c15ull;
+		std::uint64_t z = state;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		value = z ^ (z >> 31);
+	}
+	return table;
+}
+
+constexpr std::array<std::uint64_t, 256> gear_table = make_gear_table();
+
+constexpr std::size_t chunk_min_size = 2 * 1024;
+constexpr std::size_t chunk_average_size = 8 * 1024;
+constexpr std::size_t chunk_max_size = 64 * 1024;
+
+/* FastCDC with normalized chunking. Below the average size a cut needs more
+ * zero bits than above it, which narrows the spread of chunk sizes. The top
+ * bits of the Gear hash are tested, as they depend on the most input bytes. */
+inline std::size_t find_chunk_end(
+	const unsigned char* const data,
+	std::size_t size)
+{
+	constexpr std::uint64_t mask_small = ~std::uint64_t{0} << (64 - 15);
+	constexpr std::uint64_t mask_large = ~std::uint64_t{0} << (64 - 11);
+
+	if (size <= chunk_min_size)
+		return size;
+	if (size > chunk_max_size)
+		size = chunk_max_size;
+	const std::size_t normal_size = std::min(chunk_average_size, size);
+
+	std::uint64_t hash = 0;
+	std::size_t i = chunk_min_size;
+	for (; i < normal_size; ++i)
+	{
+		hash = (hash << 1) + gear_table[data[i]];
+		if ((hash & mask_small) == 0)
+			return i + 1;
+	}
+	for (; i < size; ++i)
+	{
+		hash = (hash << 1) + gear_table[data[i]];
+		if ((hash & mask_large) == 0)
+			return i + 1;
+	}
+	return size;
+}
+
+struct chunk
+{
+	std::uint64_t offset;
+	std::uint64_t size;
+	hash_128 hash;
+};
+
+inline std::vector<chunk> split_into_chunks(
+	const unsigned char* const data,
+	const std::uint64_t size)
+{
+	std::vector<chunk> result;
+	std::uint64_t offset = 0;
+	while (offset < size)
+	{
+		const std::size_t chunk_size =
+			find_chunk_end(data + offset, size - offset);
+		result.push_back(
+			{offset, chunk_size, hash_chunk(data + offset, chunk_size)});
+		offset += chunk_size;
+	}
+	return result;
+}
+
+struct delta_statistics
+{
+	std::uint64_t bytes_scanned = 0;
+	std::uint64_t bytes_written = 0;
+	/* by journaled applies */
+	std::uint64_t journal_batches = 0;
+};
+
+/* Read only mapping of a whole file. */
+class file_mapping
+{
+public:
+	file_mapping(const std::filesystem::path& path)
+	{
+		const int descriptor = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (descriptor < 0)
+			throw std::system_error(
+				errno,
+				std::generic_category(),
+				"failed to open " + path.string());
+		struct stat status;
+		if (::fstat(descriptor, &status) != 0)
+		{
+			const int error = errno;
+			::close(descriptor);
+			throw std::system_error(
+				error,
+				std::generic_category(),
+				"failed to stat " + path.string());
+		}
+		m_size = status.st_size;
+		if (m_size != 0)
+		{
+			void* const address =
+				::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+			const int error = errno;
+			::close(descriptor);
+			if (address == MAP_FAILED)
+				throw std::system_error(
+					error,
+					std::generic_category(),
+					"failed to map " + path.string());
+			m_data = static_cast<const unsigned char*>(address);
+			::madvise(address, m_size, MADV_SEQUENTIAL);
+		}
+		else
+		{
+			::close(descriptor);
+		}
+	}
+
+	file_mapping(const file_mapping&) = delete;
+
+	file_mapping& operator=(const file_mapping&) = delete;
+
+	~file_mapping()
+	{
+		if (m_data)
+			::munmap(const_cast<unsigned char*>(m_data), m_size);
+	}
+
+	const unsigned char* data() const
+	{
+		return m_data;
+	}
+
+	std::uint64_t size() const
+	{
+		return m_size;
+	}
+
+private:
+	const unsigned char* m_data = nullptr;
+	std::uint64_t m_size = 0;
+};
+
+inline void write_all(
+	const int descriptor,
+	const unsigned char* data,
+	std::uint64_t size,
+	std::uint64_t offset)
+{
+	while (size != 0)
+	{
+		const ssize_t written = ::pwrite(descriptor, data, size, offset);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			throw std::system_error(
+				errno,
+				std::generic_category(),
+				"failed to write");
+		}
+		data += written;
+		size -= written;
+		offset += written;
+	}
+}
+
+/* Brings target to the content of source, rewriting only the chunks which
+ * differ. Both files are split with content defined chunking and a source
+ * chunk is kept when the target has a chunk of the same hash at the same
+ * offset. Matching chunks at shifted offsets are rewritten too, as the target
+ * is overwritten in place and can't serve as a copy source. */
+inline void update_file_in_place(
+	const std::filesystem::path& source,
+	const std::filesystem::path& target,
+	delta_statistics& statistics)
+{
+	const file_mapping source_mapping{source};
+	std::vector<chunk> target_chunks;
+	{
+		const file_mapping target_mapping{target};
+		target_chunks =
+			split_into_chunks(target_mapping.data(), target_mapping.size());
+		statistics.bytes_scanned += target_mapping.size();
+	}
+	const std::vector<chunk> source_chunks =
+		split_into_chunks(source_mapping.data(), source_mapping.size());
+	statistics.bytes_scanned += source_mapping.size();
+
+	const int descriptor = ::open(target.c_str(), O_WRONLY | O_CLOEXEC);
+	if (descriptor < 0)
+		throw std::system_error(
+			errno,
+			std::generic_category(),
+			"failed to open " + target.string());
+	try
+	{
+		/* adjacent changed chunks are written with a single call */
+		std::uint64_t pending_offset = 0;
+		std::uint64_t pending_size = 0;
+		auto flush = [&]
+		{
+			write_all(
+				descriptor,
+				source_mapping.data() + pending_offset,
+				pending_size,
+				pending_offset);
+			statistics.bytes_written += pending_size;
+			pending_size = 0;
+		};
+
+		auto t = target_chunks.begin();
+		for (const chunk& s : source_chunks)
+		{
+			while (t != target_chunks.end() && t->offset < s.offset)
+				++t;
+			const bool unchanged = t != target_chunks.end()
+				&& t->offset == s.offset && t->size == s.size
+				&& t->hash == s.hash;
+			if (unchanged)
+			{
+				if (pending_size != 0)
+					flush();
+				continue;
+			}
+			if (pending_size == 0)
+				pending_offset = s.offset;
+			pending_size += s.size;
+		}
+		if (pending_size != 0)
+			flush();
+
+		if (::ftruncate(descriptor, source_mapping.size()) != 0)
+			throw std::system_error(
+				errno,
+				std::generic_category(),
+				"failed to truncate " + target.string());
+	}
+	catch (...)
+	{
+		::close(descriptor);
+		throw;
+	}
+	::close(descriptor);
+}
+
+#endif /* UPDATE_DIR_DELTA_H */
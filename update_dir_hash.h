@@ -0,0 +1,480 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Dominik Wójt <domin144@o2.pl>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef UPDATE_DIR_HASH_H
+#define UPDATE_DIR_HASH_H
+
+#include "update_dir_delta.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fcntl.h>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/* Values are stored in the metadata index, so they must not change. */
+enum class hash_algorithm : std::uint64_t
+{
+	murmur3 = 1,
+	lanes = 2
+};
+
+inline hash_algorithm parse_hash_algorithm(const std::string& name)
+{
+	if (name == "murmur3")
+		return hash_algorithm::murmur3;
+	if (name == "lanes")
+		return hash_algorithm::lanes;
+	throw std::runtime_error{"unknown hash algorithm " + name};
+}
+
+constexpr std::array<std::uint64_t, 32> make_lane_keys()
+{
+	std::array<std::uint64_t, 32> keys{};
+	std::uint64_t state = 0x2545f4914f6cdd1dull;
+	for (std::uint64_t& key : keys)
+	{
+		state += 0x9e3779b97f4a7c15ull;
+		std::uint64_t z = state;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		key = z ^ (z >> 31);
+	}
+	return keys;
+}
+
+constexpr std::array<std::uint64_t, 32> lane_keys = make_lane_keys();
+
+constexpr int hash_lane_count = 8;
+constexpr std::size_t hash_stripe_size = hash_lane_count * 8;
+constexpr std::size_t hash_stripes_per_block = 16;
+
+/* Runs count 64 byte stripes, starting with stripe first of a block. Every
+ * lane does a 32 x 32 -> 64 bit multiply of the keyed input and adds the raw
+ * input of the neighbouring lane, the layout of the xxHash3 inner loop. With
+ * SSE2 or AVX2 a vector register holds 2 or 4 lanes. */
+inline void accumulate_stripes(
+	std::uint64_t (&accumulators)[hash_lane_count],
+	const unsigned char* const data,
+	const std::size_t first,
+	const std::size_t count)
+{
+#if defined(__AVX2__)
+	__m256i vectors[2];
+	for (int j = 0; j < 2; ++j)
+		vectors[j] = _mm256_loadu_si256(
+			reinterpret_cast<const __m256i*>(accumulators + 4 * j));
+	for (std::size_t s = 0; s < count; ++s)
+	{
+		for (int j = 0; j < 2; ++j)
+		{
+			const __m256i value = _mm256_loadu_si256(
+				reinterpret_cast<const __m256i*>(data + s * 64 + 32 * j));
+			const __m256i key = _mm256_loadu_si256(
+				reinterpret_cast<const __m256i*>(
+					lane_keys.data() + first + s + 4 * j));
+			const __m256i keyed = _mm256_xor_si256(value, key);
+			const __m256i product = _mm256_mul_epu32(
+				keyed,
+				_mm256_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1)));
+			const __m256i swapped =
+				_mm256_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+			vectors[j] = _mm256_add_epi64(
+				vectors[j],
+				_mm256_add_epi64(swapped, product));
+		}
+	}
+	for (int j = 0; j < 2; ++j)
+		_mm256_storeu_si256(
+			reinterpret_cast<__m256i*>(accumulators + 4 * j),
+			vectors[j]);
+#elif defined(__SSE2__)
+	__m128i vectors[4];
+	for (int j = 0; j < 4; ++j)
+		vectors[j] = _mm_loadu_si128(
+			reinterpret_cast<const __m128i*>(accumulators + 2 * j));
+	for (std::size_t s = 0; s < count; ++s)
+	{
+		for (int j = 0; j < 4; ++j)
+		{
+			const __m128i value = _mm_loadu_si128(
+				reinterpret_cast<const __m128i*>(data + s * 64 + 16 * j));
+			const __m128i key = _mm_loadu_si128(
+				reinterpret_cast<const __m128i*>(
+					lane_keys.data() + first + s + 2 * j));
+			const __m128i keyed = _mm_xor_si128(value, key);
+			const __m128i product = _mm_mul_epu32(
+				keyed,
+				_mm_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1)));
+			const __m128i swapped =
+				_mm_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+			vectors[j] =
+				_mm_add_epi64(vectors[j], _mm_add_epi64(swapped, product));
+		}
+	}
+	for (int j = 0; j < 4; ++j)
+		_mm_storeu_si128(
+			reinterpret_cast<__m128i*>(accumulators + 2 * j),
+			vectors[j]);
+#else
+	for (std::size_t s = 0; s < count; ++s)
+	{
+		std::uint64_t values[hash_lane_count];
+		std::memcpy(values, data + s * 64, sizeof(values));
+		for (int i = 0; i < hash_lane_count; ++i)
+		{
+			const std::uint64_t keyed = values[i] ^ lane_keys[first + s + i];
+			accumulators[i] +=
+				values[i ^ 1] + (keyed & 0xffffffffu) * (keyed >> 32);
+		}
+	}
+#endif
+}
+
+/* Makes the accumulators depend on the order of blocks. */
+inline void scramble(std::uint64_t (&accumulators)[hash_lane_count])
+{
+	for (int i = 0; i < hash_lane_count; ++i)
+	{
+		std::uint64_t value = accumulators[i];
+		value ^= value >> 47;
+		value ^= lane_keys[hash_stripes_per_block + i];
+		accumulators[i] = value * 0x9e3779b1u;
+	}
+}
+
+inline std::uint64_t multiply_fold(
+	const std::uint64_t lhs,
+	const std::uint64_t rhs)
+{
+	const unsigned __int128 product =
+		static_cast<unsigned __int128>(lhs) * rhs;
+	return static_cast<std::uint64_t>(product)
+		^ static_cast<std::uint64_t>(product >> 64);
+}
+
+inline std::uint64_t merge_lanes(
+	const std::uint64_t (&accumulators)[hash_lane_count],
+	const std::size_t key_offset,
+	std::uint64_t result)
+{
+	for (int i = 0; i < hash_lane_count; i += 2)
+		result += multiply_fold(
+			accumulators[i] ^ lane_keys[key_offset + i],
+			accumulators[i + 1] ^ lane_keys[key_offset + i + 1]);
+	return mix_64(result);
+}
+
+/* Stripe accumulator hash in the style of xxHash3, with 128 bit output. The
+ * last partial stripe is zero padded, the size is mixed into the result. */
+inline hash_128 hash_lanes(
+	const unsigned char* const data,
+	const std::size_t size)
+{
+	std::uint64_t accumulators[hash_lane_count] = {
+		0x9e3779b1u,
+		0x9e3779b97f4a7c15ull,
+		0xc2b2ae3d27d4eb4full,
+		0x165667b19e3779f9ull,
+		0x85ebca77c2b2ae63ull,
+		0x85ebca77u,
+		0x27d4eb2f165667c5ull,
+		0x61c8864e7a143579ull};
+
+	const std::size_t stripe_count = size / hash_stripe_size;
+	for (std::size_t i = 0; i < stripe_count; i += hash_stripes_per_block)
+	{
+		const std::size_t count =
+			std::min(hash_stripes_per_block, stripe_count - i);
+		accumulate_stripes(
+			accumulators,
+			data + i * hash_stripe_size,
+			0,
+			count);
+		if (count == hash_stripes_per_block)
+			scramble(accumulators);
+	}
+	const std::size_t tail_size = size % hash_stripe_size;
+	if (tail_size != 0)
+	{
+		unsigned char tail[hash_stripe_size] = {};
+		std::memcpy(tail, data + stripe_count * hash_stripe_size, tail_size);
+		accumulate_stripes(
+			accumulators,
+			tail,
+			stripe_count % hash_stripes_per_block,
+			1);
+	}
+
+	const std::uint64_t length = size;
+	return {
+		merge_lanes(accumulators, 16, length * 0x9e3779b185ebca87ull),
+		merge_lanes(accumulators, 24, ~length * 0xc2b2ae3d27d4eb4full)};
+}
+
+inline hash_128 hash_bytes(
+	const hash_algorithm algorithm,
+	const unsigned char* const data,
+	const std::size_t size)
+{
+	switch (algorithm)
+	{
+	case hash_algorithm::murmur3:
+		return hash_chunk(data, size);
+	case hash_algorithm::lanes:
+		return hash_lanes(data, size);
+	}
+	throw std::logic_error{"invalid hash algorithm"};
+}
+
+/* Files bigger than this are hashed as a tree: every chunk is hashed on its
+ * own, possibly on different threads, and the file hash is the hash of the
+ * chunk hashes and the file size. */
+constexpr std::uint64_t tree_hash_chunk_size = 1 << 20;
+
+/* Hashes files on a set of threads fed through a bounded queue. Producers,
+ * like the scanner threads, block while the queue is full, so a slow disk
+ * doesn't make the queue grow without limit. Big files are queued chunk by
+ * chunk, so a single big file keeps all the threads busy. */
+class hash_pipeline
+{
+public:
+	hash_pipeline(
+		const hash_algorithm algorithm,
+		const unsigned thread_count,
+		const std::size_t queue_capacity) :
+		m_algorithm{algorithm},
+		m_queue_capacity{std::max<std::size_t>(queue_capacity, 1)}
+	{
+		for (unsigned i = 0; i < std::max(thread_count, 1u); ++i)
+			m_threads.emplace_back([this] { work(); });
+	}
+
+	hash_pipeline(const hash_pipeline&) = delete;
+
+	hash_pipeline& operator=(const hash_pipeline&) = delete;
+
+	~hash_pipeline()
+	{
+		close();
+	}
+
+	/* Thread safe. The key identifies the file in the result of finish. */
+	void add(
+		std::string key,
+		std::filesystem::path path,
+		const std::uint64_t size)
+	{
+		auto file = std::make_shared<file_state>();
+		file->key = std::move(key);
+		file->path = std::move(path);
+		file->size = size;
+		const std::size_t chunk_count = size > tree_hash_chunk_size
+			? (size + tree_hash_chunk_size - 1) / tree_hash_chunk_size
+			: 1;
+		file->chunk_hashes.resize(chunk_count);
+		file->remaining = chunk_count;
+		++m_queued_files;
+		m_queued_bytes += size;
+		for (std::size_t i = 0; i < chunk_count; ++i)
+			push({file, i});
+	}
+
+	/* Waits for all queued files, returns their hashes by key and rethrows the
+	 * first error. */
+	std::unordered_map<std::string, hash_128> finish()
+	{
+		close();
+		if (m_error)
+			std::rethrow_exception(m_error);
+		return std::move(m_results);
+	}
+
+	std::uint64_t queued_files() const
+	{
+		return m_queued_files;
+	}
+
+	std::uint64_t queued_bytes() const
+	{
+		return m_queued_bytes;
+	}
+
+private:
+	struct file_state
+	{
+		std::string key;
+		std::filesystem::path path;
+		std::uint64_t size;
+		std::vector<hash_128> chunk_hashes;
+		std::atomic<std::size_t> remaining;
+	};
+
+	struct job
+	{
+		std::shared_ptr<file_state> file;
+		std::size_t chunk;
+	};
+
+	void push(job job_0)
+	{
+		std::unique_lock<std::mutex> lock{m_mutex};
+		m_not_full.wait(
+			lock,
+			[this] { return m_jobs.size() < m_queue_capacity; });
+		m_jobs.push_back(std::move(job_0));
+		m_not_empty.notify_one();
+	}
+
+	void close()
+	{
+		{
+			std::lock_guard<std::mutex> lock{m_mutex};
+			m_closed = true;
+		}
+		m_not_empty.notify_all();
+		for (std::thread& thread : m_threads)
+			thread.join();
+		m_threads.clear();
+	}
+
+	void work()
+	{
+		std::vector<unsigned char> buffer(tree_hash_chunk_size);
+		while (true)
+		{
+			job job_0;
+			{
+				std::unique_lock<std::mutex> lock{m_mutex};
+				m_not_empty.wait(
+					lock,
+					[this] { return m_closed || !m_jobs.empty(); });
+				if (m_jobs.empty())
+					return;
+				job_0 = std::move(m_jobs.front());
+				m_jobs.pop_front();
+				m_not_full.notify_one();
+			}
+			try
+			{
+				hash_job(job_0, buffer);
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock{m_mutex};
+				if (!m_error)
+					m_error = std::current_exception();
+			}
+		}
+	}
+
+	void hash_job(const job& job_0, std::vector<unsigned char>& buffer)
+	{
+		file_state& file = *job_0.file;
+		const std::uint64_t offset = job_0.chunk * tree_hash_chunk_size;
+		const std::uint64_t size = std::min(
+			tree_hash_chunk_size,
+			file.size - std::min(offset, file.size));
+		const std::size_t read_size =
+			read_chunk(file.path, offset, size, buffer);
+		file.chunk_hashes[job_0.chunk] =
+			hash_bytes(m_algorithm, buffer.data(), read_size);
+		if (--file.remaining != 0)
+			return;
+
+		hash_128 result = file.chunk_hashes[0];
+		if (file.chunk_hashes.size() > 1)
+		{
+			std::vector<unsigned char> hashes(
+				file.chunk_hashes.size() * sizeof(hash_128) + 8);
+			std::memcpy(
+				hashes.data(),
+				file.chunk_hashes.data(),
+				file.chunk_hashes.size() * sizeof(hash_128));
+			std::memcpy(
+				hashes.data() + file.chunk_hashes.size() * sizeof(hash_128),
+				&file.size,
+				8);
+			result = hash_bytes(m_algorithm, hashes.data(), hashes.size());
+		}
+		std::lock_guard<std::mutex> lock{m_mutex};
+		m_results[file.key] = result;
+	}
+
+	static std::size_t read_chunk(
+		const std::filesystem::path& path,
+		const std::uint64_t offset,
+		const std::uint64_t size,
+		std::vector<unsigned char>& buffer)
+	{
+		const int descriptor = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (descriptor < 0)
+			throw std::system_error(
+				errno,
+				std::generic_category(),
+				"failed to open " + path.string());
+		std::size_t done = 0;
+		while (done < size)
+		{
+			const ssize_t result = ::pread(
+				descriptor,
+				buffer.data() + done,
+				size - done,
+				offset + done);
+			if (result < 0 && errno == EINTR)
+				continue;
+			if (result < 0)
+			{
+				const int error = errno;
+				::close(descriptor);
+				throw std::system_error(
+					error,
+					std::generic_category(),
+					"failed to read " + path.string());
+			}
+			/* the file shrank in the meantime */
+			if (result == 0)
+				break;
+			done += result;
+		}
+		::close(descriptor);
+		return done;
+	}
+
+	const hash_algorithm m_algorithm;
+	const std::size_t m_queue_capacity;
+	std::vector<std::thread> m_threads;
+	std::mutex m_mutex;
+	std::condition_variable m_not_full;
+	std::condition_variable m_not_empty;
+	std::deque<job> m_jobs;
+	bool m_closed = false;
+	std::unordered_map<std::string, hash_128> m_results;
+	std::exception_ptr m_error;
+	std::atomic<std::uint64_t> m_queued_files{0};
+	std::atomic<std::uint64_t> m_queued_bytes{0};
+};
+
+#endif /* UPDATE_DIR_HASH_H */
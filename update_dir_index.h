@@ -0,0 +1,273 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Dominik Wójt <domin144@o2.pl>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef UPDATE_DIR_INDEX_H
+#define UPDATE_DIR_INDEX_H
+
+#include "update_dir_delta.h"
+#include "update_dir_hash.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+#include <vector>
+
+/* Name of the index file kept in the root of the target directory. */
+constexpr char metadata_index_name[] = ".update_dir_index";
+
+/* On disk layout, in native byte order:
+ *   metadata_index_header
+ *   metadata_record[record_count], sorted by path
+ *   path characters[strings_size]
+ * Records are fixed size and 8 byte aligned, so a mapped file is used as is. */
+struct metadata_index_header
+{
+	char magic[8];
+	/* hash_algorithm of the hashes */
+	std::uint64_t hash_id;
+	std::uint64_t record_count;
+	std::uint64_t strings_size;
+};
+
+/* State of a source file at the time it was last synced. */
+struct metadata_record
+{
+	std::uint64_t path_offset;
+	std::uint32_t path_size;
+	std::uint32_t reserved;
+	std::uint64_t size;
+	std::int64_t mtime_ns;
+	std::uint64_t inode;
+	hash_128 hash;
+
+	bool matches(
+		const std::uint64_t size_0,
+		const std::int64_t mtime_ns_0,
+		const std::uint64_t inode_0) const
+	{
+		return size == size_0 && mtime_ns == mtime_ns_0 && inode == inode_0;
+	}
+};
+
+constexpr char metadata_index_magic[8] =
+	{'U', 'D', 'I', 'D', 'X', '0', '0', '2'};
+
+/* Read only view of an index file. A missing or malformed file, or one with
+ * hashes of another algorithm, gives an empty index, so the next sync just
+ * rehashes everything. */
+class metadata_index
+{
+public:
+	metadata_index(
+		const std::filesystem::path& path,
+		const hash_algorithm algorithm) :
+		m_algorithm{algorithm}
+	{
+		const int descriptor = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (descriptor < 0)
+			return;
+		struct stat status;
+		if (::fstat(descriptor, &status) == 0
+			&& std::uint64_t(status.st_size) >= sizeof(metadata_index_header))
+		{
+			m_size = status.st_size;
+			void* const address =
+				::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+			if (address != MAP_FAILED)
+				m_data = static_cast<const char*>(address);
+		}
+		::close(descriptor);
+		if (m_data && !validate())
+		{
+			::munmap(const_cast<char*>(m_data), m_size);
+			m_data = nullptr;
+		}
+	}
+
+	metadata_index(const metadata_index&) = delete;
+
+	metadata_index& operator=(const metadata_index&) = delete;
+
+	~metadata_index()
+	{
+		if (m_data)
+			::munmap(const_cast<char*>(m_data), m_size);
+	}
+
+	std::uint64_t size() const
+	{
+		return m_data ? header().record_count : 0;
+	}
+
+	const metadata_record* find(const std::string_view path) const
+	{
+		if (!m_data)
+			return nullptr;
+		const metadata_record* const begin = records();
+		const metadata_record* const end = begin + size();
+		const metadata_record* const found = std::lower_bound(
+			begin,
+			end,
+			path,
+			[this](const metadata_record& record, const std::string_view key)
+			{ return record_path(record) < key; });
+		if (found != end && record_path(*found) == path)
+			return found;
+		return nullptr;
+	}
+
+private:
+	const metadata_index_header& header() const
+	{
+		return *reinterpret_cast<const metadata_index_header*>(m_data);
+	}
+
+	const metadata_record* records() const
+	{
+		return reinterpret_cast<const metadata_record*>(
+			m_data + sizeof(metadata_index_header));
+	}
+
+	std::string_view record_path(const metadata_record& record) const
+	{
+		return {strings() + record.path_offset, record.path_size};
+	}
+
+	const char* strings() const
+	{
+		return reinterpret_cast<const char*>(records() + size());
+	}
+
+	bool validate() const
+	{
+		const metadata_index_header& header_0 = header();
+		if (std::memcmp(
+				header_0.magic,
+				metadata_index_magic,
+				sizeof(metadata_index_magic))
+			!= 0)
+			return false;
+		if (header_0.hash_id != static_cast<std::uint64_t>(m_algorithm))
+			return false;
+		const std::uint64_t records_size = m_size - sizeof(header_0);
+		if (header_0.record_count > records_size / sizeof(metadata_record))
+			return false;
+		if (sizeof(header_0) + header_0.record_count * sizeof(metadata_record)
+				+ header_0.strings_size
+			!= m_size)
+			return false;
+		for (std::uint64_t i = 0; i < header_0.record_count; ++i)
+		{
+			const metadata_record& record = records()[i];
+			const std::uint64_t strings_size = header_0.strings_size;
+			if (record.path_offset > strings_size
+				|| record.path_size > strings_size - record.path_offset)
+				return false;
+		}
+		return true;
+	}
+
+	const hash_algorithm m_algorithm;
+	const char* m_data = nullptr;
+	std::uint64_t m_size = 0;
+};
+
+/* Collects records, which must be added in path order, and writes them as a
+ * new index. */
+class metadata_index_builder
+{
+public:
+	void add(
+		const std::string_view path,
+		const std::uint64_t size,
+		const std::int64_t mtime_ns,
+		const std::uint64_t inode,
+		const hash_128& hash)
+	{
+		metadata_record record{};
+		record.path_offset = m_strings.size();
+		record.path_size = path.size();
+		record.size = size;
+		record.mtime_ns = mtime_ns;
+		record.inode = inode;
+		record.hash = hash;
+		m_strings.append(path);
+		m_records.push_back(record);
+	}
+
+	/* Writes to a temporary file renamed over the old index, so a crash leaves
+	 * either the old or the new index. */
+	void write(
+		const std::filesystem::path& path,
+		const hash_algorithm algorithm) const
+	{
+		const std::filesystem::path temporary_path =
+			path.string() + ".tmp";
+		const int descriptor = ::open(
+			temporary_path.c_str(),
+			O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+			0644);
+		if (descriptor < 0)
+			throw std::system_error(
+				errno,
+				std::generic_category(),
+				"failed to create " + temporary_path.string());
+		try
+		{
+			metadata_index_header header{};
+			std::memcpy(
+				header.magic,
+				metadata_index_magic,
+				sizeof(metadata_index_magic));
+			header.hash_id = static_cast<std::uint64_t>(algorithm);
+			header.record_count = m_records.size();
+			header.strings_size = m_strings.size();
+
+			std::uint64_t offset = 0;
+			auto append = [&](const void* data, const std::uint64_t size)
+			{
+				write_all(
+					descriptor,
+					static_cast<const unsigned char*>(data),
+					size,
+					offset);
+				offset += size;
+			};
+			append(&header, sizeof(header));
+			append(
+				m_records.data(),
+				m_records.size() * sizeof(metadata_record));
+			append(m_strings.data(), m_strings.size());
+			if (::fsync(descriptor) != 0)
+				throw std::system_error(
+					errno,
+					std::generic_category(),
+					"failed to sync " + temporary_path.string());
+		}
+		catch (...)
+		{
+			::close(descriptor);
+			throw;
+		}
+		::close(descriptor);
+		std::filesystem::rename(temporary_path, path);
+	}
+
+private:
+	std::vector<metadata_record> m_records;
+	std::string m_strings;
+};
+
+#endif /* UPDATE_DIR_INDEX_H */
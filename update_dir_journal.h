@@ -0,0 +1,344 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Dominik Wójt <domin144@o2.pl>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef UPDATE_DIR_JOURNAL_H
+#define UPDATE_DIR_JOURNAL_H
+
+#include "update_dir_delta.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+#include <unordered_set>
+#include <vector>
+
+/* Name of the journal file kept in the root of the target directory while a
+ * journaled apply runs. */
+constexpr char journal_name[] = ".update_dir_journal";
+
+enum class journal_operation : std::uint32_t
+{
+	/* the staged file or symlink is renamed to the path */
+	stage = 1,
+	remove = 2,
+	/* the directory was created before the commit */
+	create_directory = 3,
+	commit = 4,
+	/* the batch was executed, written before a later batch can commit */
+	applied = 5
+};
+
+/* On disk, every record is this header followed by path_size characters of a
+ * path relative to the target root. */
+struct journal_record_header
+{
+	std::uint32_t operation;
+	std::uint32_t path_size;
+};
+
+/* Temporary name of a file written before it is renamed to the path. It is
+ * kept in the same directory, so the rename is atomic. */
+inline std::filesystem::path staging_path(const std::filesystem::path& path)
+{
+	return path.parent_path()
+		/ ('.' + path.filename().string() + ".update_dir_tmp");
+}
+
+struct journal_record
+{
+	journal_operation operation;
+	std::string path;
+};
+
+/* Write-ahead log of changes to the target tree. Files are staged under
+ * temporary names and directories are created as the operations are added.
+ * Renames and removals wait for the commit of their batch.
+ *
+ * A commit makes the staged data durable with a single syncfs, appends a
+ * commit record after the records of the batch with one fdatasync, and only
+ * then executes the batch. So a whole batch costs two flushes, however many
+ * files it has. Renames left volatile by a crash are redone from the
+ * journal.
+ *
+ * After a batch is executed, an applied record is appended. It reaches the
+ * disk with the syncfs of the next commit, so only the last committed batch
+ * can be replayed on top of later changes, and none were made by then. */
+class journal
+{
+public:
+	journal(const std::filesystem::path& target_root) :
+		m_root{target_root},
+		m_path{target_root / journal_name},
+		m_descriptor{::open(
+			m_path.c_str(),
+			O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+			0644)}
+	{
+		if (m_descriptor < 0)
+			throw std::system_error(
+				errno,
+				std::generic_category(),
+				"failed to create " + m_path.string());
+	}
+
+	journal(const journal&) = delete;
+
+	journal& operator=(const journal&) = delete;
+
+	~journal()
+	{
+		::close(m_descriptor);
+	}
+
+	/* Records reach the file in blocks, without a sync, so after a crash most
+	 * of an uncommitted batch can be rolled back. */
+	void add(const journal_operation operation, const std::string_view path)
+	{
+		m_pending.push_back({operation, std::string{path}});
+		append_record(m_buffer, operation, path);
+		if (m_buffer.size() >= 64 * 1024)
+			write_buffer();
+	}
+
+	std::size_t pending() const
+	{
+		return m_pending.size();
+	}
+
+	std::uint64_t commit_count() const
+	{
+		return m_commit_count;
+	}
+
+	/* The staged files have to be completely written by now. */
+	void commit()
+	{
+		if (m_pending.empty())
+			return;
+		sync_file_system();
+		append_record(m_buffer, journal_operation::commit, {});
+		write_buffer();
+		if (::fdatasync(m_descriptor) != 0)
+			throw std::system_error(
+				errno,
+				std::generic_category(),
+				"failed to sync " + m_path.string());
+		redo(m_root, m_pending);
+		m_pending.clear();
+		append_record(m_buffer, journal_operation::applied, {});
+		write_buffer();
+		++m_commit_count;
+	}
+
+	/* Makes the executed operations durable and drops the journal. Pending
+	 * operations are rolled back. */
+	void finish()
+	{
+		roll_back(m_root, m_pending);
+		m_pending.clear();
+		sync_file_system();
+		std::filesystem::remove(m_path);
+	}
+
+	/* Executes a committed batch, which may have been executed, fully or in
+	 * part, before a crash. A rename done before also means the removal
+	 * preceding it in the batch was done, and the removal would now delete
+	 * the renamed file, so it is skipped. */
+	static void redo(
+		const std::filesystem::path& root,
+		const std::vector<journal_record>& records)
+	{
+		std::unordered_set<std::string> renamed;
+		for (const journal_record& record : records)
+		{
+			if (record.operation == journal_operation::stage
+				&& !std::filesystem::exists(std::filesystem::symlink_status(
+					staging_path(root / record.path))))
+				renamed.insert(record.path);
+		}
+
+		for (const journal_record& record : records)
+		{
+			const std::filesystem::path path = root / record.path;
+			switch (record.operation)
+			{
+			case journal_operation::stage:
+				if (!renamed.count(record.path))
+					std::filesystem::rename(staging_path(path), path);
+				break;
+			case journal_operation::remove:
+				if (!renamed.count(record.path))
+					std::filesystem::remove_all(path);
+				break;
+			case journal_operation::create_directory:
+				std::filesystem::create_directory(path);
+				break;
+			case journal_operation::commit:
+			case journal_operation::applied:
+				break;
+			}
+		}
+	}
+
+	/* Undoes operations of an uncommitted batch, in reverse order. Only staged
+	 * files and new directories, which are still empty then, were made. */
+	static void roll_back(
+		const std::filesystem::path& root,
+		const std::vector<journal_record>& records)
+	{
+		for (auto record = records.rbegin(); record != records.rend();
+			 ++record)
+		{
+			const std::filesystem::path path = root / record->path;
+			std::error_code error;
+			if (record->operation == journal_operation::stage)
+				std::filesystem::remove(staging_path(path), error);
+			else if (record->operation == journal_operation::create_directory)
+				std::filesystem::remove(path, error);
+		}
+	}
+
+private:
+	static void append_record(
+		std::string& buffer,
+		const journal_operation operation,
+		const std::string_view path)
+	{
+		const journal_record_header header{
+			static_cast<std::uint32_t>(operation),
+			static_cast<std::uint32_t>(path.size())};
+		buffer.append(reinterpret_cast<const char*>(&header), sizeof(header));
+		buffer.append(path);
+	}
+
+	void write_buffer()
+	{
+		write_all(
+			m_descriptor,
+			reinterpret_cast<const unsigned char*>(m_buffer.data()),
+			m_buffer.size(),
+			m_size);
+		m_size += m_buffer.size();
+		m_buffer.clear();
+	}
+
+	void sync_file_system() const
+	{
+		if (::syncfs(m_descriptor) != 0)
+			throw std::system_error(
+				errno,
+				std::generic_category(),
+				"failed to sync file system of " + m_root.string());
+	}
+
+	const std::filesystem::path m_root;
+	const std::filesystem::path m_path;
+	const int m_descriptor;
+	std::uint64_t m_size = 0;
+	std::uint64_t m_commit_count = 0;
+	std::vector<journal_record> m_pending;
+	std::string m_buffer;
+};
+
+struct recovery_statistics
+{
+	std::uint64_t replayed = 0;
+	std::uint64_t rolled_back = 0;
+};
+
+/* Brings the target back to a consistent state after an interrupted journaled
+ * apply. Committed batches not marked as applied are replayed, the rest is
+ * rolled back. A record torn by the crash ends the journal. Staged files whose
+ * records never made it to the journal are left, the next sync removes them
+ * as not in the source. */
+inline recovery_statistics recover_journal(
+	const std::filesystem::path& target_root)
+{
+	recovery_statistics result;
+	const std::filesystem::path path = target_root / journal_name;
+	const int descriptor = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (descriptor < 0)
+	{
+		if (errno == ENOENT)
+			return result;
+		throw std::system_error(
+			errno,
+			std::generic_category(),
+			"failed to open " + path.string());
+	}
+
+	std::string content;
+	char buffer[64 * 1024];
+	while (true)
+	{
+		const ssize_t size = ::read(descriptor, buffer, sizeof(buffer));
+		if (size < 0 && errno == EINTR)
+			continue;
+		if (size <= 0)
+			break;
+		content.append(buffer, size);
+	}
+	::close(descriptor);
+
+	/* a committed batch waits for its applied record, if there is any */
+	std::vector<journal_record> committed;
+	std::vector<journal_record> batch;
+	auto replay = [&]
+	{
+		journal::redo(target_root, committed);
+		result.replayed += committed.size();
+		committed.clear();
+	};
+	std::size_t offset = 0;
+	while (content.size() - offset >= sizeof(journal_record_header))
+	{
+		journal_record_header header;
+		std::memcpy(&header, content.data() + offset, sizeof(header));
+		offset += sizeof(header);
+		const auto operation =
+			static_cast<journal_operation>(header.operation);
+		if (header.operation < std::uint32_t(journal_operation::stage)
+			|| header.operation > std::uint32_t(journal_operation::applied)
+			|| header.path_size > content.size() - offset)
+			break;
+		journal_record record{
+			operation,
+			content.substr(offset, header.path_size)};
+		offset += header.path_size;
+		if (operation == journal_operation::applied)
+		{
+			committed.clear();
+			continue;
+		}
+		replay();
+		if (operation == journal_operation::commit)
+			committed.swap(batch);
+		else
+			batch.push_back(std::move(record));
+	}
+	replay();
+	journal::roll_back(target_root, batch);
+	result.rolled_back = batch.size();
+
+	const int root_descriptor =
+		::open(target_root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (root_descriptor >= 0)
+	{
+		::syncfs(root_descriptor);
+		::close(root_descriptor);
+	}
+	std::filesystem::remove(path);
+	return result;
+}
+
+#endif /* UPDATE_DIR_JOURNAL_H */
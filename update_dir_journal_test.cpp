@@ -0,0 +1,146 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Dominik Wójt <domin144@o2.pl>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "update_dir_journal.h"
+#include "utils.h"
+
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+namespace fs = std::filesystem;
+
+void write_file(const fs::path& path, const std::string& content)
+{
+	std::ofstream file{path, std::ios::binary | std::ios::trunc};
+	file << content;
+	if (!file)
+		throw std::runtime_error{"failed to write " + path.string()};
+}
+
+std::string read_file(const fs::path& path)
+{
+	std::ifstream file{path, std::ios::binary};
+	if (!file)
+		throw std::runtime_error{"failed to read " + path.string()};
+	return {std::istreambuf_iterator<char>(file), {}};
+}
+
+/* The journal is dropped without finish, like by a crash after the batches
+ * were executed, before the applied record of the last one reached the disk.
+ * The recovery must not redo the removals over the files and directories
+ * which replaced the removed ones. */
+void check_crash_after_apply(const fs::path& root)
+{
+	/* a file replaced by a directory, which is created in a batch after the
+	 * removal */
+	write_file(root / "replaced_file", "old");
+	/* a directory replaced by a file, in a single batch */
+	fs::create_directories(root / "replaced_directory" / "old");
+	{
+		journal journal_0{root};
+		journal_0.add(journal_operation::remove, "replaced_file");
+		journal_0.commit();
+
+		fs::create_directory(root / "replaced_file");
+		journal_0.add(journal_operation::create_directory, "replaced_file");
+		write_file(staging_path(root / "replaced_file" / "a"), "new content");
+		journal_0.add(journal_operation::stage, "replaced_file/a");
+		write_file(staging_path(root / "replaced_directory"), "new file");
+		journal_0.add(journal_operation::remove, "replaced_directory");
+		journal_0.add(journal_operation::stage, "replaced_directory");
+		journal_0.commit();
+	}
+	const fs::path journal_path = root / journal_name;
+	fs::resize_file(
+		journal_path,
+		fs::file_size(journal_path) - sizeof(journal_record_header));
+
+	const recovery_statistics recovered = recover_journal(root);
+	my_assert(recovered.replayed == 4, "wrong count of replayed operations");
+	my_assert(recovered.rolled_back == 0, "committed operations rolled back");
+	my_assert(
+		read_file(root / "replaced_file" / "a") == "new content",
+		"contents of a directory replacing a file lost");
+	my_assert(
+		read_file(root / "replaced_directory") == "new file",
+		"file replacing a directory lost");
+	my_assert(!fs::exists(journal_path), "journal left");
+}
+
+/* A batch with its applied record is not replayed, even over a target which
+ * doesn't match it. Without the record, as when the crash came before the
+ * batch was executed completely, it is. */
+void check_crash_during_apply(const fs::path& root)
+{
+	fs::create_directories(root / "directory" / "old");
+	write_file(staging_path(root / "directory"), "new file");
+	write_file(root / "file", "old");
+	write_file(staging_path(root / "file"), "new");
+	{
+		journal journal_0{root};
+		journal_0.add(journal_operation::remove, "directory");
+		journal_0.add(journal_operation::stage, "directory");
+		journal_0.add(journal_operation::stage, "file");
+		journal_0.commit();
+	}
+	/* undo the renames, as if they were lost */
+	fs::rename(root / "file", staging_path(root / "file"));
+	write_file(root / "file", "old");
+	fs::rename(root / "directory", staging_path(root / "directory"));
+	fs::create_directories(root / "directory" / "old");
+
+	const recovery_statistics recovered = recover_journal(root);
+	my_assert(recovered.replayed == 0, "applied batch replayed");
+	my_assert(
+		read_file(root / "file") == "old",
+		"applied batch replayed over the target");
+
+	{
+		journal journal_0{root};
+		journal_0.add(journal_operation::remove, "directory");
+		journal_0.add(journal_operation::stage, "directory");
+		journal_0.add(journal_operation::stage, "file");
+		journal_0.commit();
+	}
+	/* the applied record is cut off and the first rename lost */
+	const fs::path journal_path = root / journal_name;
+	fs::resize_file(
+		journal_path,
+		fs::file_size(journal_path) - sizeof(journal_record_header));
+	fs::rename(root / "directory", staging_path(root / "directory"));
+	fs::create_directories(root / "directory" / "old");
+
+	const recovery_statistics replayed = recover_journal(root);
+	my_assert(replayed.replayed == 3, "committed batch not replayed");
+	my_assert(
+		read_file(root / "directory") == "new file",
+		"lost rename not redone");
+	my_assert(read_file(root / "file") == "new", "renamed file lost");
+}
+
+int main()
+try
+{
+	const fs::path root =
+		fs::temp_directory_path() / "update_dir_journal_test";
+	fs::remove_all(root);
+	fs::create_directories(root / "after_apply");
+	fs::create_directories(root / "during_apply");
+	check_crash_after_apply(root / "after_apply");
+	check_crash_during_apply(root / "during_apply");
+	fs::remove_all(root);
+	std::cout << "journal recovery ok\n";
+	return 0;
+}
+catch (std::exception& e)
+{
+	std::cerr << "standard exception caught: " << e.what() << std::endl;
+	return 1;
+}
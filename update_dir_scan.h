@@ -0,0 +1,426 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Dominik Wójt <domin144@o2.pl>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef UPDATE_DIR_SCAN_H
+#define UPDATE_DIR_SCAN_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+enum class entry_type : std::uint8_t
+{
+	file,
+	directory,
+	symlink,
+	other
+};
+
+/* Metadata of a single entry. Strings are kept in the storage of the owning
+ * index and referenced by offset, so an entry is a few plain integers. */
+struct index_entry
+{
+	std::uint64_t path_offset;
+	std::uint32_t path_size;
+	std::uint32_t link_size;
+	std::uint64_t link_offset;
+	std::uint64_t size;
+	std::int64_t mtime_ns;
+	std::uint64_t inode;
+	entry_type type;
+};
+
+/* Entries of one directory tree, with paths relative to its root. */
+class directory_index
+{
+public:
+	void add(
+		const std::string_view path,
+		const struct stat& status,
+		const std::string_view link_target)
+	{
+		index_entry entry;
+		entry.path_offset = m_strings.size();
+		entry.path_size = path.size();
+		m_strings.append(path);
+		entry.link_offset = m_strings.size();
+		entry.link_size = link_target.size();
+		m_strings.append(link_target);
+		entry.size = status.st_size;
+		entry.mtime_ns = std::int64_t{status.st_mtim.tv_sec} * 1000000000
+			+ status.st_mtim.tv_nsec;
+		entry.inode = status.st_ino;
+		if (S_ISREG(status.st_mode))
+			entry.type = entry_type::file;
+		else if (S_ISDIR(status.st_mode))
+			entry.type = entry_type::directory;
+		else if (S_ISLNK(status.st_mode))
+			entry.type = entry_type::symlink;
+		else
+			entry.type = entry_type::other;
+		m_entries.push_back(entry);
+	}
+
+	/* Moves all entries of the other index to this one. */
+	void merge(directory_index&& other)
+	{
+		const std::uint64_t base = m_strings.size();
+		m_strings.append(other.m_strings);
+		for (index_entry entry : other.m_entries)
+		{
+			entry.path_offset += base;
+			entry.link_offset += base;
+			m_entries.push_back(entry);
+		}
+		other.m_strings.clear();
+		other.m_entries.clear();
+	}
+
+	/* Copies all entries of the other index, with the prefix prepended to
+	 * their paths. */
+	void append(const directory_index& other, const std::string_view prefix)
+	{
+		for (const index_entry& other_entry : other.m_entries)
+		{
+			index_entry entry = other_entry;
+			entry.path_offset = m_strings.size();
+			entry.path_size += prefix.size();
+			m_strings.append(prefix);
+			m_strings.append(other.path(other_entry));
+			entry.link_offset = m_strings.size();
+			m_strings.append(other.link_target(other_entry));
+			m_entries.push_back(entry);
+		}
+	}
+
+	/* Sorts entries by path, so parent directories precede their contents. */
+	void sort()
+	{
+		std::sort(
+			m_entries.begin(),
+			m_entries.end(),
+			[this](const index_entry& lhs, const index_entry& rhs)
+			{ return path(lhs) < path(rhs); });
+	}
+
+	/* Requires sorted index. */
+	const index_entry* find(const std::string_view path_0) const
+	{
+		const auto found = std::lower_bound(
+			m_entries.begin(),
+			m_entries.end(),
+			path_0,
+			[this](const index_entry& entry, const std::string_view key)
+			{ return path(entry) < key; });
+		if (found != m_entries.end() && path(*found) == path_0)
+			return &*found;
+		return nullptr;
+	}
+
+	std::string_view path(const index_entry& entry) const
+	{
+		return std::string_view{m_strings}.substr(
+			entry.path_offset,
+			entry.path_size);
+	}
+
+	std::string_view link_target(const index_entry& entry) const
+	{
+		return std::string_view{m_strings}.substr(
+			entry.link_offset,
+			entry.link_size);
+	}
+
+	const std::vector<index_entry>& entries() const
+	{
+		return m_entries;
+	}
+
+private:
+	std::string m_strings;
+	std::vector<index_entry> m_entries;
+};
+
+/* Scans several directory trees at once with a pool of work-stealing threads.
+ * Each work item is one directory. A worker takes items from the back of its
+ * own queue and, when that is empty, steals from the front of the others. */
+class tree_scanner
+{
+public:
+	/* Called from the scanning threads for every entry found. */
+	using entry_callback = std::function<void(
+		std::size_t tree,
+		std::string_view relative_path,
+		const struct stat& status)>;
+
+	tree_scanner(const unsigned thread_count) :
+		m_thread_count{std::max(thread_count, 1u)}
+	{
+	}
+
+	void set_entry_callback(entry_callback callback)
+	{
+		m_entry_callback = std::move(callback);
+	}
+
+	/* Returns one sorted index per root. Roots which don't exist give empty
+	 * indexes. */
+	std::vector<directory_index> scan(
+		const std::vector<std::filesystem::path>& roots)
+	{
+		m_roots = roots;
+		m_queues.clear();
+		for (unsigned i = 0; i < m_thread_count; ++i)
+			m_queues.push_back(std::make_unique<worker_queue>());
+		m_worker_indexes.assign(m_thread_count, {});
+		for (auto& indexes : m_worker_indexes)
+			indexes.resize(roots.size());
+		m_error = nullptr;
+		m_failed = false;
+		m_pending = 0;
+
+		for (std::size_t tree = 0; tree < roots.size(); ++tree)
+		{
+			std::error_code error;
+			if (std::filesystem::is_directory(roots[tree], error))
+				push(tree % m_thread_count, {tree, std::string{}});
+		}
+
+		std::vector<std::thread> threads;
+		for (unsigned i = 1; i < m_thread_count; ++i)
+			threads.emplace_back([this, i] { work(i); });
+		work(0);
+		for (std::thread& thread : threads)
+			thread.join();
+		if (m_error)
+			std::rethrow_exception(m_error);
+
+		std::vector<directory_index> result(roots.size());
+		for (auto& indexes : m_worker_indexes)
+			for (std::size_t tree = 0; tree < roots.size(); ++tree)
+				result[tree].merge(std::move(indexes[tree]));
+		for (directory_index& index : result)
+			index.sort();
+		m_worker_indexes.clear();
+		return result;
+	}
+
+private:
+	struct work_item
+	{
+		std::size_t tree;
+		std::string relative_path;
+	};
+
+	struct worker_queue
+	{
+		std::mutex mutex;
+		std::deque<work_item> items;
+	};
+
+	void push(const unsigned worker, work_item item)
+	{
+		++m_pending;
+		worker_queue& queue = *m_queues[worker];
+		std::lock_guard<std::mutex> lock{queue.mutex};
+		queue.items.push_back(std::move(item));
+	}
+
+	bool take(const unsigned worker, work_item& item)
+	{
+		{
+			worker_queue& queue = *m_queues[worker];
+			std::lock_guard<std::mutex> lock{queue.mutex};
+			if (!queue.items.empty())
+			{
+				item = std::move(queue.items.back());
+				queue.items.pop_back();
+				return true;
+			}
+		}
+		for (unsigned i = 1; i < m_thread_count; ++i)
+		{
+			worker_queue& queue = *m_queues[(worker + i) % m_thread_count];
+			std::lock_guard<std::mutex> lock{queue.mutex};
+			if (!queue.items.empty())
+			{
+				item = std::move(queue.items.front());
+				queue.items.pop_front();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void work(const unsigned worker)
+	{
+		work_item item;
+		while (m_pending != 0 && !m_failed)
+		{
+			if (!take(worker, item))
+			{
+				std::this_thread::yield();
+				continue;
+			}
+			try
+			{
+				scan_directory(worker, item);
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock{m_error_mutex};
+				if (!m_error)
+					m_error = std::current_exception();
+				m_failed = true;
+			}
+			--m_pending;
+		}
+	}
+
+	void scan_directory(const unsigned worker, const work_item& item)
+	{
+		const std::filesystem::path directory =
+			m_roots[item.tree] / item.relative_path;
+		directory_index& index = m_worker_indexes[worker][item.tree];
+		std::string relative_path;
+		std::string link_target;
+		for (const auto& child :
+			 std::filesystem::directory_iterator{directory})
+		{
+			const std::string name = child.path().filename().string();
+			relative_path = item.relative_path.empty()
+				? name
+				: item.relative_path + '/' + name;
+
+			struct stat status;
+			if (::lstat(child.path().c_str(), &status) != 0)
+				throw std::system_error(
+					errno,
+					std::generic_category(),
+					"failed to stat " + child.path().string());
+
+			link_target.clear();
+			if (S_ISLNK(status.st_mode))
+				link_target = std::filesystem::read_symlink(child.path());
+
+			index.add(relative_path, status, link_target);
+			if (m_entry_callback)
+				m_entry_callback(item.tree, relative_path, status);
+			if (S_ISDIR(status.st_mode))
+				push(worker, {item.tree, relative_path});
+		}
+	}
+
+	const unsigned m_thread_count;
+	entry_callback m_entry_callback;
+	std::vector<std::filesystem::path> m_roots;
+	std::vector<std::unique_ptr<worker_queue>> m_queues;
+	std::vector<std::vector<directory_index>> m_worker_indexes;
+	std::atomic<std::size_t> m_pending{0};
+	std::atomic<bool> m_failed{false};
+	std::mutex m_error_mutex;
+	std::exception_ptr m_error;
+};
+
+enum class change_kind
+{
+	added,
+	removed,
+	modified,
+	/* only metadata differs, content is known to be the same */
+	touched
+};
+
+struct change
+{
+	change_kind kind;
+	entry_type type;
+	std::string path;
+};
+
+inline bool is_modified(
+	const directory_index& source,
+	const index_entry& source_entry,
+	const directory_index& target,
+	const index_entry& target_entry)
+{
+	if (source_entry.type != target_entry.type)
+		return true;
+	switch (source_entry.type)
+	{
+	case entry_type::file:
+		return source_entry.size != target_entry.size
+			|| source_entry.mtime_ns != target_entry.mtime_ns;
+	case entry_type::symlink:
+		return source.link_target(source_entry)
+			!= target.link_target(target_entry);
+	default:
+		/* directory mtime changes with its content, which is compared on
+		 * its own */
+		return false;
+	}
+}
+
+/* Compares two sorted indexes. Removals come in reverse path order, so
+ * contents go before their directory. Additions and modifications come in path
+ * order, so directories go before their contents. */
+inline std::vector<change> diff(
+	const directory_index& source,
+	const directory_index& target)
+{
+	std::vector<change> removals;
+	std::vector<change> result;
+	const auto& source_entries = source.entries();
+	const auto& target_entries = target.entries();
+	auto s = source_entries.begin();
+	auto t = target_entries.begin();
+	while (s != source_entries.end() || t != target_entries.end())
+	{
+		const int order = s == source_entries.end() ? 1
+			: t == target_entries.end()				? -1
+			: source.path(*s).compare(target.path(*t));
+		if (order < 0)
+		{
+			result.push_back(
+				{change_kind::added, s->type, std::string{source.path(*s)}});
+			++s;
+		}
+		else if (order > 0)
+		{
+			removals.push_back(
+				{change_kind::removed, t->type, std::string{target.path(*t)}});
+			++t;
+		}
+		else
+		{
+			if (is_modified(source, *s, target, *t))
+				result.push_back(
+					{change_kind::modified,
+					 s->type,
+					 std::string{source.path(*s)}});
+			++s;
+			++t;
+		}
+	}
+	result.insert(result.begin(), removals.rbegin(), removals.rend());
+	return result;
+}
+
+#endif /* UPDATE_DIR_SCAN_H */
@@ -0,0 +1,236 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Dominik Wójt <domin144@o2.pl>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef UPDATE_DIR_WATCH_H
+#define UPDATE_DIR_WATCH_H
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <poll.h>
+#include <string>
+#include <stdexcept>
+#include <sys/inotify.h>
+#include <system_error>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+/* Part of the source tree which has to be synced again. A recursive path
+ * covers the whole subtree, otherwise only the entry itself. */
+struct dirty_path
+{
+	std::string relative_path;
+	bool recursive;
+};
+
+/* Watches a directory tree with inotify. Every directory gets its own watch,
+ * new directories are added as they appear. */
+class directory_watcher
+{
+public:
+	directory_watcher(const std::filesystem::path& root) :
+		m_root{root},
+		m_descriptor{::inotify_init1(IN_NONBLOCK | IN_CLOEXEC)}
+	{
+		if (m_descriptor < 0)
+			throw std::system_error(
+				errno,
+				std::generic_category(),
+				"failed to initialize inotify");
+		try
+		{
+			add_watches(std::string{});
+		}
+		catch (...)
+		{
+			::close(m_descriptor);
+			throw;
+		}
+	}
+
+	directory_watcher(const directory_watcher&) = delete;
+
+	directory_watcher& operator=(const directory_watcher&) = delete;
+
+	~directory_watcher()
+	{
+		::close(m_descriptor);
+	}
+
+	/* Blocks until something changes, then collects events until none came
+	 * for the debounce period, but no longer than max_delay in total. A path
+	 * under a recursive dirty path is not reported on its own. When the event
+	 * queue overflows, events are lost, so the whole tree is reported. */
+	std::vector<dirty_path> wait(
+		const std::chrono::milliseconds debounce,
+		const std::chrono::milliseconds max_delay)
+	{
+		using clock = std::chrono::steady_clock;
+		std::map<std::string, bool> dirty;
+		wait_readable(-1);
+		const clock::time_point deadline = clock::now() + max_delay;
+		while (true)
+		{
+			read_events(dirty);
+			const auto left =
+				std::chrono::duration_cast<std::chrono::milliseconds>(
+					deadline - clock::now());
+			if (left.count() <= 0
+				|| !wait_readable(std::min(debounce, left).count()))
+				break;
+		}
+
+		std::vector<dirty_path> result;
+		const std::string* covering = nullptr;
+		for (const auto& [path, recursive] : dirty)
+		{
+			const bool covered = covering
+				&& (covering->empty()
+					|| (path.compare(0, covering->size(), *covering) == 0
+						&& path.size() > covering->size()
+						&& path[covering->size()] == '/'));
+			if (covered)
+				continue;
+			result.push_back({path, recursive});
+			if (recursive)
+				covering = &path;
+		}
+		return result;
+	}
+
+private:
+	static constexpr std::uint32_t watch_mask = IN_CREATE | IN_DELETE
+		| IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO
+		| IN_DELETE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW;
+
+	/* Adding a watch to an already watched directory returns its old
+	 * descriptor, so a moved directory gets its path updated. */
+	void add_watches(const std::string& relative_path)
+	{
+		add_watch(relative_path);
+		const std::filesystem::path directory = m_root / relative_path;
+		std::error_code error;
+		for (auto i = std::filesystem::recursive_directory_iterator{
+				 directory,
+				 error};
+			 !error && i != std::filesystem::recursive_directory_iterator{};
+			 i.increment(error))
+		{
+			if (i->is_directory(error) && !i->is_symlink(error))
+				add_watch(std::filesystem::relative(i->path(), m_root)
+							  .generic_string());
+		}
+	}
+
+	void add_watch(const std::string& relative_path)
+	{
+		const std::filesystem::path path = m_root / relative_path;
+		const int watch =
+			::inotify_add_watch(m_descriptor, path.c_str(), watch_mask);
+		if (watch < 0)
+		{
+			/* removed in the meantime, its parent reports it */
+			if (errno == ENOENT || errno == ENOTDIR)
+				return;
+			throw std::system_error(
+				errno,
+				std::generic_category(),
+				"failed to watch " + path.string());
+		}
+		m_watches[watch] = relative_path == "." ? std::string{} : relative_path;
+	}
+
+	bool wait_readable(const int timeout_ms)
+	{
+		pollfd poll_descriptor{m_descriptor, POLLIN, 0};
+		while (true)
+		{
+			const int result = ::poll(&poll_descriptor, 1, timeout_ms);
+			if (result >= 0)
+				return result > 0;
+			if (errno != EINTR)
+				throw std::system_error(
+					errno,
+					std::generic_category(),
+					"failed to poll inotify");
+		}
+	}
+
+	void read_events(std::map<std::string, bool>& dirty)
+	{
+		alignas(inotify_event) char buffer[64 * 1024];
+		while (true)
+		{
+			const ssize_t size = ::read(m_descriptor, buffer, sizeof(buffer));
+			if (size < 0)
+			{
+				if (errno == EAGAIN)
+					return;
+				if (errno == EINTR)
+					continue;
+				throw std::system_error(
+					errno,
+					std::generic_category(),
+					"failed to read inotify");
+			}
+			for (ssize_t offset = 0; offset < size;)
+			{
+				const inotify_event& event =
+					*reinterpret_cast<const inotify_event*>(buffer + offset);
+				handle_event(event, dirty);
+				offset += sizeof(inotify_event) + event.len;
+			}
+		}
+	}
+
+	void handle_event(
+		const inotify_event& event,
+		std::map<std::string, bool>& dirty)
+	{
+		if (event.mask & IN_Q_OVERFLOW)
+		{
+			dirty[std::string{}] = true;
+			return;
+		}
+		const auto watch = m_watches.find(event.wd);
+		if (watch == m_watches.end())
+			return;
+		if (event.mask & IN_IGNORED)
+		{
+			m_watches.erase(watch);
+			return;
+		}
+		if (event.mask & IN_DELETE_SELF)
+		{
+			if (watch->second.empty())
+				throw std::runtime_error{"source directory was removed"};
+			return;
+		}
+		if (event.len == 0)
+			return;
+
+		const std::string& directory = watch->second;
+		const std::string name{event.name};
+		const std::string path =
+			directory.empty() ? name : directory + '/' + name;
+		const bool new_directory =
+			(event.mask & IN_ISDIR) && (event.mask & (IN_CREATE | IN_MOVED_TO));
+		if (new_directory)
+			add_watches(path);
+		bool& recursive = dirty[path];
+		recursive = recursive || new_directory;
+	}
+
+	const std::filesystem::path m_root;
+	const int m_descriptor;
+	std::unordered_map<int, std::string> m_watches;
+};
+
+#endif /* UPDATE_DIR_WATCH_H */
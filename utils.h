@@ -11,6 +11,7 @@
 #include <string>
 #include <iostream>
 #include <cstdint>
+#include <stdexcept>
 
 void my_assert(const bool condition, const char *const description)
 {
@@ -18,6 +19,16 @@ void my_assert(const bool condition, const char *const description)
         throw std::runtime_error(description);
 }
 
+/* Checks of invariants and preconditions on hot paths. Like assert, they are
+ * left out, condition included, when NDEBUG is defined. Unlike assert, they
+ * throw, so the tests can catch them. */
+#ifdef NDEBUG
+#define my_debug_assert(condition, description) static_cast<void>(0)
+#else
+#define my_debug_assert(condition, description) \
+    my_assert(condition, description)
+#endif
+
 template<typename TRatio>
 struct Ratio_to_double
 {